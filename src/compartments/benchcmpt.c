@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "cmpt.h"
+#include "morello.h"
+
+/**
+ * Measures the cost of a call into a compartment and back for each
+ * trampoline variant, and of a direct call to the same function for
+ * comparison. Prints one CSV line per variant:
+ *
+ *     variant,skip_cid_swap,skip_callee_saved,skip_sanitise,iterations,ns_per_call
+ *
+ * The direct call is reported as variant -1.
+ */
+
+#define ITERATIONS 1000000ul
+
+// This function will run inside compartment
+static void *fun(void *arg)
+{
+    return arg;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double bench(cmpt_fun_t *f)
+{
+    void *volatile arg = NULL;
+    double start = now_ns();
+    for (size_t k = 0; k < ITERATIONS; k++) {
+        arg = f(arg);
+    }
+    return (now_ns() - start) / (double)ITERATIONS;
+}
+
+int main(int argc, char const *argv[])
+{
+    init_cmpt_manager(3000);
+    cmpt_fun_t *volatile direct = fun;
+    printf("-1,,,,%lu,%.2f\n", ITERATIONS, bench(direct));
+    for (unsigned v = 0; v < 8; v++) {
+        cmpt_flags_t flags = {
+            .skip_cid_swap = v & 1u,
+            .skip_callee_saved = v & 2u,
+            .skip_sanitise = v & 4u
+        };
+        cmpt_fun_t *f = create_cmpt(fun, 4 /* pages */, &flags);
+        if (f == NULL) {
+            perror("create_cmpt");
+            return 1;
+        }
+        // first call commits the stack pages
+        f(NULL);
+        double ns = bench(f);
+        printf("%u,%d,%d,%d,%lu,%.2f\n", v, flags.skip_cid_swap, flags.skip_callee_saved, flags.skip_sanitise, ITERATIONS, ns);
+        destroy_cmpt(f);
+    }
+    return 0;
+}
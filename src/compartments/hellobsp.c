@@ -28,7 +28,8 @@ int main(int argc, char const *argv[])
     cmpt_flags_t flags = {
         .pcc_system_reg = false,
         .stack_store_local = false,
-        .stack_mutable_load = true
+        .stack_mutable_load = true,
+        .stack_policy = CMPT_STACK_LAZY
     };
     cmpt_fun_t *fun_in_cmpt = create_cmpt(fun, 4 /* pages */, &flags);
     if (!fun_in_cmpt) {
@@ -52,5 +53,34 @@ int main(int argc, char const *argv[])
     printf("csp: %s\n", cap_to_str(NULL, cheri_csp_get()));
     printf("cid: %s\n", cap_to_str(NULL, cheri_cid_get()));
     printf("pcc: %s\n", cap_to_str(NULL, cheri_pcc_get()));
-    return *res;
+    cmpt_stack_usage_t usage;
+    if (get_cmpt_stack_usage(CMPT_STACK_LAZY, &usage) == 0) {
+        printf("stacks: %zu, reserved: %zu bytes, resident: %zu bytes\n", usage.count, usage.reserved, usage.resident);
+    }
+    if (*res != 0) {
+        return *res;
+    }
+
+    // Destroy the compartment: the handle becomes stale
+    if (destroy_cmpt(fun_in_cmpt) != 0) {
+        perror("destroy_cmpt");
+        return 1;
+    }
+    arg = 9;
+    if (fun_in_cmpt(&arg) != NULL || arg != 9 || destroy_cmpt(fun_in_cmpt) == 0) {
+        printf("stale handle is still usable\n");
+        return 1;
+    }
+
+    // New compartment reuses the slot and memory of the destroyed one
+    cmpt_fun_t *again = create_cmpt(fun, 4 /* pages */, &flags);
+    if (!again) {
+        perror("create_cmpt");
+        return 1;
+    }
+    if (again(&arg) != &arg || fun_in_cmpt(&arg) != NULL) {
+        printf("recycled compartment doesn't work\n");
+        return 1;
+    }
+    return arg;
 }
@@ -9,6 +9,17 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+/**
+ * How memory within bounds of a compartment stack
+ * is backed by physical memory.
+ */
+typedef enum {
+    CMPT_STACK_LAZY = 0,        // pages are committed on first use
+    CMPT_STACK_PREFAULT,        // all pages are committed in advance
+    CMPT_STACK_HUGE,            // like lazy, but with transparent huge pages
+    CMPT_STACK_POLICIES
+} cmpt_stack_policy_t;
+
 /**
  * Compartment options.
  */
@@ -16,18 +27,59 @@ typedef struct {
     bool pcc_system_reg;        // enables PERM_SYS_REG in compartment
     bool stack_store_local;     // enables STORE_LOCAL perm in stack
     bool stack_mutable_load;    // enables MUTABLE_LOAD perm in stack
+    cmpt_stack_policy_t stack_policy; // backing of the stack
+    bool skip_cid_swap;         // compartment runs with caller's CID_EL0
+    bool skip_callee_saved;     // target preserves callee-saved registers (as per PCS)
+    bool skip_sanitise;         // only clear registers with caller's stack and data
 } cmpt_flags_t;
 
+/**
+ * Maximum number of compartments (all of them share
+ * one copy of the trampoline code).
+ */
+#ifndef CMPT_SLOTS
+#define CMPT_SLOTS 4096
+#endif
+
+/**
+ * Default size of memory reserved for stacks of all
+ * compartments (and again for huge page stacks).
+ */
+#ifndef CMPT_STACK_ARENA
+#define CMPT_STACK_ARENA (256ul << 20)
+#endif
+
 /**
  * Wrappable function type.
  */
 typedef void *(cmpt_fun_t)(void* arg);
 
+/**
+ * Compartment manager options.
+ */
+typedef struct {
+    unsigned warm_count;        // number of instances to prepare in advance
+    unsigned warm_stack_pages;  // stack size of these instances (in pages)
+    cmpt_stack_policy_t warm_stack_policy; // stack policy of these instances
+    size_t stack_arena_size;    // size of each of the two stack arenas (0 for default)
+} cmpt_manager_opts_t;
+
 /**
  * Initialise compartment manager.
  */
 void init_cmpt_manager(size_t seed);
 
+/**
+ * Initialise compartment manager with options. If opts
+ * is not NULL, memory for opts->warm_count instances is
+ * allocated in advance, so that creating compartments
+ * with this stack size requires no system calls.
+ *
+ * Return value: 0 on success, or -1 on failure with
+ * errno set to indicate the reason.
+ */
+int init_cmpt_manager_opts(size_t seed, const cmpt_manager_opts_t *opts);
+
 /**
  * Create compartment entry around a function pointer.
  * Optional flags may be used to modify properties of
@@ -39,10 +91,45 @@ void init_cmpt_manager(size_t seed);
  * Return value: on success, this function returns a
  * callable object (sentry) that can be used in stead
  * of the original target function. On failure NULL is
- * returned and errno is set to indicate the reason.
+ * returned and errno is set to indicate the reason
+ * (ENOMEM when all CMPT_SLOTS slots are in use or
+ * retired).
+ *
+ * Memory of destroyed compartments is reused if a stack
+ * with the same policy that is large enough is available.
  */
 cmpt_fun_t *create_cmpt(cmpt_fun_t *target, unsigned stack_pages, const cmpt_flags_t *flags);
 
+/**
+ * Destroy compartment: its stack and data are scrubbed
+ * and kept for reuse, and its slot is freed (or retired
+ * if it has used all its generations). All copies of the
+ * handle become stale: calling a stale handle returns
+ * NULL without entering any compartment. Must not be
+ * called while the compartment is running.
+ *
+ * Return value: 0 on success, or -1 with errno set to
+ * EINVAL if cmpt is not a handle of a live compartment.
+ */
+int destroy_cmpt(cmpt_fun_t *cmpt);
+
+/**
+ * Memory used by stacks with some policy.
+ */
+typedef struct {
+    size_t count;               // number of stacks (live or kept for reuse)
+    size_t reserved;            // bytes within bounds of these stacks
+    size_t resident;            // bytes backed by physical memory
+} cmpt_stack_usage_t;
+
+/**
+ * Report memory used by stacks with the given policy.
+ *
+ * Return value: 0 on success, or -1 on failure with
+ * errno set to indicate the reason.
+ */
+int get_cmpt_stack_usage(cmpt_stack_policy_t policy, cmpt_stack_usage_t *usage);
+
 /**
  * Removes permissions from sentry and returns sentry
  * with fewer permissions. The sentry must be either
@@ -19,33 +19,160 @@
 #define PROT_CAP_INVOKE 0x2000 // Purecap libc fix-ups
 #endif
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 // Linux 5.14
+#endif
+
+#define HUGE_PAGE_SIZE (2ul << 20)
+
 int getpagesize(void);
 
-static void *_exec_allocate();
+static void *_trampoline_allocate();
 static void *_data_allocate();
-static void *_stack_allocate(unsigned pages);
+static void *_arena_allocate(size_t size, bool huge);
+static void *_stack_allocate(unsigned pages, cmpt_stack_policy_t policy);
+static void _stack_release(void *stack);
 static void *_bsp_seal_cap(const void *cap, const void *cid);
 
+/**
+ * All compartments share one mapping with trampoline code:
+ *
+ *   [ generations ][ stubs: CMPT_SLOTS x STUB_SIZE ][ slots: CMPT_SLOTS x STUB_SIZE ][ common code ]
+ *
+ * Stub number N is the entry point of compartment N. It reaches its
+ * slot (the sealed capability pair) PC-relatively at the fixed distance
+ * SLOTS_DIST, so all stubs are identical copies that are written once
+ * in init_cmpt_manager. Everything else the trampoline needs is in the
+ * compartment data reached through C29 after branching to the pair.
+ *
+ * Slots are reused after destroy_cmpt. The generation of a slot is
+ * encoded in the base of the compartment handle, which is moved down
+ * into the (inaccessible) generations area by one step per generation.
+ * The stub compares the base of PCC with the one stored in the slot
+ * and returns NULL without entering the compartment if they differ.
+ * A slot is retired once all its generations have been used.
+ */
+#define STUB_SIZE 64
+#define STUB_RET 52
+#define SLOTS_DIST (CMPT_SLOTS * STUB_SIZE)
+#define GENS_SPACE (4 * SLOTS_DIST)
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
 static void *__sealer = NULL;
 static void *__cid = NULL;
+static char *__code = NULL;     // RX capability (with CAP_INVOKE) for the whole mapping
+static void *__slots = NULL;    // RW capability for the slots
+static size_t __gen_step = 0;   // distance between bases of handles of two generations
+static size_t __gen_count = 0;  // number of distinct generations
 
 typedef struct {
     void *stack;    // compartment's stack pointer
     void *cid;      // placeholder for caller CID
+    void *id;       // compartment id with CID permission (sealed)
+    void *target;   // RB-sealed target function pointer (sentry)
+    void *ret;      // return stub of the compartment (sentry)
 } cmpt_data_t;
 
 typedef struct {
-    void *cid;      // compartment id with CID permission (sealed)
-    void *target;   // RB-sealed target function pointer (sentry)
     void *entry;    // sealed compartment entry (BSP-sealed)
     cmpt_data_t *data; // rw pointer to store stack pointers (BSP-sealed)
     void *exit;     // sealed compartment exit (BSP-sealed)
+    size_t base;    // base of the valid handle (0 if the slot is free)
+    size_t gen;     // generation of the slot
 } cmpt_impl_t;
 
+_Static_assert(sizeof(cmpt_impl_t) == STUB_SIZE, "slots and stubs must have the same stride");
+_Static_assert(SLOTS_DIST < (1 << 20), "slots must be within the range of ADR");
+
+/**
+ * Compartment data records are carved from one mapping with one record
+ * per slot, and stacks are carved from two large arenas: one for huge
+ * page stacks and one for all others. Bounds of the capabilities keep
+ * them apart, so neither needs its own mapping.
+ */
+static cmpt_data_t *__data = NULL;      // RW capability (with CAP_INVOKE) for all records
+typedef struct {
+    void *stack;
+    cmpt_stack_policy_t policy;
+} cmpt_stack_t;
+typedef struct {
+    size_t offset;
+    size_t size;
+} cmpt_range_t;
+
+/**
+ * Holes are parts of an arena released by stacks below the used part. They are
+ * sorted and never adjacent to each other or to the unused part, so every hole is
+ * followed by a live or pooled stack and there are at most as many holes as stacks.
+ */
+typedef struct {
+    char *mem;                          // RW capability for the arena
+    size_t used;
+    cmpt_range_t holes[2 * CMPT_SLOTS];
+    size_t hole_count;
+} cmpt_arena_t;
+
+static cmpt_arena_t __arena;            // lazy and prefaulted stacks
+static cmpt_arena_t __huge_arena;       // huge page stacks
+
+static cmpt_stack_t __stacks[CMPT_SLOTS]; // stacks of live compartments
+static cmpt_stack_t __pool[CMPT_SLOTS]; // scrubbed stacks ready for reuse
+static size_t __pool_count = 0;
+static size_t __free[CMPT_SLOTS];       // destroyed slots (FIFO)
+static size_t __free_head = 0, __free_count = 0;
+static size_t __next_slot = 0;          // first slot never used
+
 void init_cmpt_manager(size_t seed)
+{
+    init_cmpt_manager_opts(seed, NULL);
+}
+
+int init_cmpt_manager_opts(size_t seed, const cmpt_manager_opts_t *opts)
 {
     __sealer = cheri_perms_and(getauxptr(AT_CHERI_SEAL_CAP), PERM_SEAL);
     __cid = cheri_address_set(getauxptr(AT_CHERI_CID_CAP), seed);
+    if (__code == NULL) {
+        __code = _trampoline_allocate();
+        if (__code == NULL) {
+            return -1;
+        }
+    }
+    if (__data == NULL) {
+        __data = _data_allocate();
+        if (__data == NULL) {
+            return -1;
+        }
+    }
+    size_t arena_size = opts && opts->stack_arena_size ? opts->stack_arena_size : CMPT_STACK_ARENA;
+    if (__arena.mem == NULL) {
+        __arena.mem = _arena_allocate(arena_size, false);
+        if (__arena.mem == NULL) {
+            return -1;
+        }
+    }
+    if (__huge_arena.mem == NULL) {
+        __huge_arena.mem = _arena_allocate(arena_size, true);
+        if (__huge_arena.mem == NULL) {
+            return -1;
+        }
+    }
+    if (opts == NULL) {
+        return 0;
+    }
+    if (opts->warm_count > CMPT_SLOTS - __pool_count) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (unsigned k = 0; k < opts->warm_count; k++) {
+        // fresh stacks don't need to be scrubbed
+        void *stack = _stack_allocate(opts->warm_stack_pages, opts->warm_stack_policy);
+        if (stack == NULL) {
+            return -1;
+        }
+        __pool[__pool_count++] = (cmpt_stack_t){ stack, opts->warm_stack_policy };
+    }
+    return 0;
 }
 
 /**
@@ -54,6 +181,83 @@ void init_cmpt_manager(size_t seed)
  */
 #define LABEL(name) ".global " name " \n.hidden " name "\n.size " name ",16\n.type " name ",%function\n" name ":\n"
 
+/**
+ * Trampoline variants. The stub is the same for all of them, and the
+ * common code is generated for every combination of these parameters:
+ *
+ *  - cid: swap CID_EL0 on entry and exit.
+ *  - saved: save and restore callee-saved registers (otherwise
+ *    the target is trusted to preserve them as required by PCS,
+ *    and they are not sanitised).
+ *  - clean: sanitise all registers not used for arguments or the
+ *    result (otherwise only clear the registers that the trampoline
+ *    itself loaded with the caller's stack and compartment data).
+ *
+ * The variant number is the combination of skipped steps: 1 for
+ * the CID swap, 2 for saving registers and 4 for sanitisation.
+ */
+#define IF_0(...)
+#define IF_1(...) __VA_ARGS__
+#define IF_(c, ...) IF_##c(__VA_ARGS__)
+#define IF(c, ...) IF_(c, __VA_ARGS__)
+
+#define ZERO_ENTRY_11 \
+".irp    rn,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,18,19,20,21,22,23,24,25,26,27,28\n" \
+"   mov    w\\rn, #0\n"             /* except c0 (arg), c17 (target) and c30 (return stub) */ \
+".endr\n"
+#define ZERO_ENTRY_10 \
+".irp    rn,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,18,27,28\n" \
+"   mov    w\\rn, #0\n"             /* callee-saved registers are not saved, so they are kept */ \
+".endr\n"
+#define ZERO_ENTRY_01 \
+"   mov     w27, #0\n"              /* callee's stack (also in csp) */ \
+"   mov     w28, #0\n"              /* caller's stack */
+#define ZERO_ENTRY_00 ZERO_ENTRY_01
+#define ZERO_ENTRY_(clean, saved) ZERO_ENTRY_##clean##saved
+#define ZERO_ENTRY(clean, saved) ZERO_ENTRY_(clean, saved)
+
+#define TRAMPOLINE_VARIANT(v, cid, saved, clean) \
+LABEL("_cmpt_start_" #v) \
+IF(saved, \
+"   stp     c25, c26, [csp, #(2*32)]\n" \
+"   stp     c23, c24, [csp, #(3*32)]\n" \
+"   stp     c21, c22, [csp, #(4*32)]\n" \
+"   stp     c19, c20, [csp, #(5*32)]\n") \
+IF(cid, \
+"   mrs     c28, CID_EL0\n" \
+"   str     c28, [c29, #16]\n"      /* swap cid */ \
+"   ldr     c28, [c29, #32]\n" \
+"   msr     CID_EL0, c28\n") \
+"   ldp     c17, c30, [c29, #48]\n" /* target (sentry), return stub (sentry) */ \
+"   mov     c28, csp\n" \
+"   ldr     c27, [c29]\n"           /* swap callee's and caller's stacks */ \
+"   str     c28, [c29]\n" \
+"   mov     c29, c27\n" \
+"   mov     csp, c29\n"             /* enable callee's stack and fp */ \
+ZERO_ENTRY(clean, saved) \
+"   br      c17\n"                  /* call target function */ \
+LABEL("_cmpt_end_" #v) \
+IF(clean, \
+".irp    rn,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18\n" \
+"   mov    w\\rn, #0\n"             /* except c0 (res) and callee-saved registers */ \
+".endr\n") \
+IF(cid, \
+"   ldr     c28, [c29, #16]\n"      /* swap cid */ \
+"   msr     CID_EL0, c28\n") \
+"   mov     c28, csp\n" \
+"   ldr     c27, [c29]\n"           /* swap callee's and caller's stacks */ \
+"   str     c28, [c29]\n" \
+"   mov     csp, c27\n"             /* restore caller's stack */ \
+IF(saved, \
+"   ldp     c19, c20, [csp, #(5*32)]\n" \
+"   ldp     c21, c22, [csp, #(4*32)]\n" \
+"   ldp     c23, c24, [csp, #(3*32)]\n" \
+"   ldp     c25, c26, [csp, #(2*32)]\n") \
+"   ldp     c27, c28, [csp, #(1*32)]\n" \
+"   ldp     c29, c30, [csp, #(0*32)]\n" \
+"   add     csp, csp, #(6*32)\n" \
+"   ret     c30\n"
+
 #if defined(__GNUC__) && !defined(__clang__)
 __attribute__ ((used))
 #else
@@ -61,53 +265,41 @@ __attribute__ ((naked,used))
 #endif
 static void _trampoline()
 { __asm__ volatile(
+LABEL("_cmpt_stub")                 // copied for every slot
+"   adr     c16, . + " XSTR(SLOTS_DIST) "\n"
+"   ldr     x17, [c16, #48]\n"      // base of the valid handle
+"   gcbase  x16, c16\n"             // base of the handle used for this call
+"   cmp     x16, x17\n"
+"   b.ne    1f\n"                   // stale handle
 "   sub     csp, csp, #(6*32)\n"
 "   stp     c29, c30, [csp, #(0*32)]\n"
 "   stp     c27, c28, [csp, #(1*32)]\n"
-"   stp     c25, c26, [csp, #(2*32)]\n"
-"   stp     c23, c24, [csp, #(3*32)]\n"
-"   stp     c21, c22, [csp, #(4*32)]\n"
-"   stp     c19, c20, [csp, #(5*32)]\n"
-"   adr     c27, _trampoline_end\n"
-"   alignu  c27, c27, #4\n"
-"   ldp     c26, c30, [c27, #0]\n"  // cid, target (sentry)
-"   ldp     c27, c28, [c27, #32]\n" // entry (BSP-sealed), data (BSP-sealed)
+".if . - _cmpt_stub != 32\n"
+".error \"wrong offset of the slot load\"\n"
+".endif\n"
+"   adr     c27, . + " XSTR(SLOTS_DIST) " - 32\n"
+"   ldp     c27, c28, [c27, #0]\n"  // entry (BSP-sealed), data (BSP-sealed)
 "   brs     c29, c27, c28\n"        // switch to compartment
-LABEL("_cmpt_start")
-"   mrs     c28, CID_EL0\n"
-"   str     c28, [c29, #16]\n"      // swap cid
-"   msr     CID_EL0, c26\n"
-"   mov     c28, csp\n"
-"   ldr     c27, [c29]\n"           // swap callee's and caller's stacks
-"   str     c28, [c29]\n"           //
-"   mov     c29, c27\n"             //
-"   mov     csp, c29\n"             // enable callee's stack and fp
-".irp    rn,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28\n"
-"   mov    w\\rn, #0\n"             // except c0 (arg) and c30 (target)
-".endr\n"
-"   blr     c30\n"                  // call target function
-".irp    rn,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18\n"
-"   mov    w\\rn, #0\n"             // except c0 (res) and callee-saved registers (overwritten later)
-".endr\n"
-"   adr     c27, _trampoline_end\n"
-"   alignu  c27, c27, #4\n"
-"   ldp     c28, c27, [c27, #48]\n" // data (BSP-sealed), exit (BSP-sealed)
-"   brs     c29, c27, c28\n"        // return from compartment
-LABEL("_cmpt_end")
-"   ldr     c28, [c29, #16]\n"      // swap cid
-"   msr     CID_EL0, c28\n"
-"   mov     c28, csp\n"
-"   ldr     c27, [c29]\n"           // swap callee's and caller's stacks
-"   str     c28, [c29]\n"           //
-"   mov     csp, c27\n"             // restore caller's stack
-"   ldp     c19, c20, [csp, #(5*32)]\n"
-"   ldp     c21, c22, [csp, #(4*32)]\n"
-"   ldp     c23, c24, [csp, #(3*32)]\n"
-"   ldp     c25, c26, [csp, #(2*32)]\n"
-"   ldp     c27, c28, [csp, #(1*32)]\n"
-"   ldp     c29, c30, [csp, #(0*32)]\n"
-"   add     csp, csp, #(6*32)\n"
+"1: mov     x0, #0\n"
 "   ret     c30\n"
+".if . - _cmpt_stub != " XSTR(STUB_RET) "\n"
+".error \"wrong offset of the return stub\"\n"
+".endif\n"
+"   adr     c27, . + " XSTR(SLOTS_DIST) " - " XSTR(STUB_RET) "\n" // return stub: the target returns here
+"   ldp     c28, c27, [c27, #16]\n" // data (BSP-sealed), exit (BSP-sealed)
+"   brs     c29, c27, c28\n"        // return from compartment
+".if . - _cmpt_stub != " XSTR(STUB_SIZE) "\n"
+".error \"wrong size of the stub\"\n"
+".endif\n"
+LABEL("_cmpt_stub_end")             // common code starts here
+TRAMPOLINE_VARIANT(0, 1, 1, 1)      // full isolation (default)
+TRAMPOLINE_VARIANT(1, 0, 1, 1)
+TRAMPOLINE_VARIANT(2, 1, 0, 1)
+TRAMPOLINE_VARIANT(3, 0, 0, 1)
+TRAMPOLINE_VARIANT(4, 1, 1, 0)
+TRAMPOLINE_VARIANT(5, 0, 1, 0)
+TRAMPOLINE_VARIANT(6, 1, 0, 0)
+TRAMPOLINE_VARIANT(7, 0, 0, 0)      // mutually trusting compartments
 "   udf     #0\n"
 LABEL("_trampoline_end")
 );}
@@ -119,12 +311,168 @@ LABEL("_trampoline_end")
 #define RWI_PERMS (RW_PERMS | PERM_CAP_INVOKE)
 #define RXI_PERMS (RX_PERMS | PERM_CAP_INVOKE)
 
+/**
+ * Returns the arena that a stack was carved from.
+ */
+static cmpt_arena_t *_stack_arena(const void *stack)
+{
+    size_t offset = cheri_address_get(stack) - cheri_base_get(__huge_arena.mem);
+    return offset < cheri_length_get(__huge_arena.mem) ? &__huge_arena : &__arena;
+}
+
+/**
+ * Returns capability for the part of the arena taken by a stack.
+ * Unlike the stack itself, it can be used for memory management.
+ */
+static void *_stack_vmem(const void *stack)
+{
+    char *mem = _stack_arena(stack)->mem;
+    size_t offset = cheri_address_get(stack) - cheri_base_get(mem);
+    return cheri_bounds_set_exact(mem + offset, cheri_length_get(stack));
+}
+
+/**
+ * Finds entry and exit points of a trampoline variant
+ * (offsets from the start of the common code).
+ */
+#define VARIANT_CASE(v) \
+    case v: \
+        *start = (const char *)GET_NEAR_ADDR("_cmpt_start_" #v) - common; \
+        *end = (const char *)GET_NEAR_ADDR("_cmpt_end_" #v) - common; \
+        break;
+
+static void _variant_offsets(unsigned variant, size_t *start, size_t *end)
+{
+    const char *common = GET_NEAR_ADDR("_cmpt_stub_end");
+    switch (variant) {
+        VARIANT_CASE(0)
+        VARIANT_CASE(1)
+        VARIANT_CASE(2)
+        VARIANT_CASE(3)
+        VARIANT_CASE(4)
+        VARIANT_CASE(5)
+        VARIANT_CASE(6)
+        VARIANT_CASE(7)
+    }
+}
+
+/**
+ * Takes the smallest pooled stack of the given policy that is large
+ * enough, or carves a new one from the arena if there is none. If the
+ * arena is full, all pooled stacks are released and carving is retried.
+ */
+static void *_stack_get(unsigned stack_pages, cmpt_stack_policy_t policy)
+{
+    size_t sz = cheri_representable_length((size_t)getpagesize() * stack_pages);
+    if (policy == CMPT_STACK_HUGE) {
+        sz = cheri_representable_length(cheri_align_up(sz, HUGE_PAGE_SIZE));
+    }
+    size_t best = __pool_count;
+    for (size_t k = 0; k < __pool_count; k++) {
+        size_t len = cheri_length_get(__pool[k].stack);
+        if (__pool[k].policy == policy && len >= sz
+            && (best == __pool_count || len < cheri_length_get(__pool[best].stack))) {
+            best = k;
+        }
+    }
+    if (best < __pool_count) {
+        void *stack = __pool[best].stack;
+        __pool[best] = __pool[--__pool_count];
+        return stack;
+    }
+    void *stack = _stack_allocate(stack_pages, policy);
+    if (stack == NULL && stack_pages != 0 && __pool_count > 0) {
+        while (__pool_count > 0) {
+            _stack_release(__pool[--__pool_count].stack);
+        }
+        stack = _stack_allocate(stack_pages, policy);
+    }
+    return stack;
+}
+
+/**
+ * Scrubs a stack and puts it back into the pool. Prefaulted
+ * stacks are filled with zeros and stay committed; pages of
+ * other stacks are dropped and will be zero-filled on demand.
+ * If the pool is full, the stack is released to the arena.
+ */
+static void _stack_put(const cmpt_stack_t *s)
+{
+    if (s->policy == CMPT_STACK_PREFAULT
+        || madvise(_stack_vmem(s->stack), cheri_length_get(s->stack), MADV_DONTNEED) != 0) {
+        memset(s->stack, 0, cheri_length_get(s->stack));
+    }
+    if (__pool_count < CMPT_SLOTS) {
+        __pool[__pool_count++] = *s;
+    } else {
+        _stack_release(s->stack);
+    }
+}
+
+/**
+ * Adds up the sizes of resident pages of a stack.
+ */
+static size_t _stack_resident(const void *stack)
+{
+    size_t pgsz = getpagesize();
+    size_t pages = cheri_length_get(stack) / pgsz;
+    unsigned char vec[256];
+    size_t resident = 0;
+    char *vmem = _stack_vmem(stack);
+    for (size_t k = 0; k < pages; k += sizeof(vec)) {
+        size_t n = pages - k < sizeof(vec) ? pages - k : sizeof(vec);
+        if (mincore(vmem + k * pgsz, n * pgsz, vec) != 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < n; i++) {
+            resident += (vec[i] & 1) ? pgsz : 0;
+        }
+    }
+    return resident;
+}
+
+int get_cmpt_stack_usage(cmpt_stack_policy_t policy, cmpt_stack_usage_t *usage)
+{
+    if (!cheri_is_valid(__arena.mem) || usage == NULL || policy >= CMPT_STACK_POLICIES) {
+        errno = EINVAL;
+        return -1;
+    }
+    *usage = (cmpt_stack_usage_t){ 0, 0, 0 };
+    for (size_t k = 0; k < __next_slot + __pool_count; k++) {
+        const cmpt_stack_t *s = k < __next_slot ? &__stacks[k] : &__pool[k - __next_slot];
+        if (s->stack != NULL && s->policy == policy) {
+            usage->count++;
+            usage->reserved += cheri_length_get(s->stack);
+            usage->resident += _stack_resident(s->stack);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Finds the slot of a compartment handle. Fails if the handle
+ * is not a handle or if the compartment was destroyed.
+ */
+static bool _slot_get(cmpt_fun_t *cmpt, size_t *slot)
+{
+    size_t stubs = cheri_address_get(__code) + GENS_SPACE;
+    size_t addr = cheri_address_get(cmpt);
+    if (!cheri_is_valid(__code) || !cheri_is_valid(cmpt) || !cheri_is_sealed(cmpt)
+        || addr < stubs || addr >= stubs + SLOTS_DIST || (addr - stubs) % STUB_SIZE != 1) {
+        return false;
+    }
+    *slot = (addr - stubs) / STUB_SIZE;
+    const cmpt_impl_t *impl = (cmpt_impl_t *)__slots + *slot;
+    return impl->base != 0 && impl->base == cheri_base_get(cmpt);
+}
+
 cmpt_fun_t *create_cmpt(cmpt_fun_t *target, unsigned stack_pages, const cmpt_flags_t *flags)
 {
     /**
      * Check that global capabilities have been initialised.
      */
-    if (!cheri_is_valid(__sealer)
+    if (!cheri_is_valid(__sealer) || !cheri_is_valid(__code) || !cheri_is_valid(__data)
+        || !cheri_is_valid(__arena.mem) || !cheri_is_valid(__huge_arena.mem)
 #if !defined(__GLIBC__) // Morello Glibc currently doesn't return a capability for AT_CHERI_CID_CAP
         || !cheri_is_valid(__cid)
 #endif
@@ -132,77 +480,119 @@ cmpt_fun_t *create_cmpt(cmpt_fun_t *target, unsigned stack_pages, const cmpt_fla
         errno = EFAULT; // not initialised
         return NULL;
     }
+    if (__free_count == 0 && __next_slot == CMPT_SLOTS) {
+        errno = ENOMEM; // all slots are in use
+        return NULL;
+    }
 
     /**
-     * Relocate trampoline code.
+     * Locate entry and exit points of the trampoline
+     * variant in the shared code.
      */
-    const char *t_start = GET_NEAR_ADDR("_trampoline");
-    const char *t_end= GET_NEAR_ADDR("_trampoline_end");
-    const char *c_start = GET_NEAR_ADDR("_cmpt_start");
-    const char *c_end = GET_NEAR_ADDR("_cmpt_end");
-    size_t code_sz = t_end - t_start;
-    size_t start_offset = c_start - t_start;
-    size_t end_offset = c_end - t_start;
-    void *code = _exec_allocate();
-    if (code == NULL) {
-        return NULL;
+    unsigned variant = 0;
+    if (flags) {
+        variant = (flags->skip_cid_swap ? 1 : 0) | (flags->skip_callee_saved ? 2 : 0) | (flags->skip_sanitise ? 4 : 0);
     }
-    memcpy(code, cheri_align_down(t_start, 4), code_sz);
+    size_t start_offset, end_offset;
+    _variant_offsets(variant, &start_offset, &end_offset);
+    char *code = cheri_bounds_set(__code + GENS_SPACE + 2 * SLOTS_DIST, cheri_get_tail(__code + GENS_SPACE + 2 * SLOTS_DIST));
+    char *stubs = cheri_perms_and(cheri_bounds_set(__code + GENS_SPACE, 2 * SLOTS_DIST), RX_PERMS);
 
     /**
-     * Store compartment switch data.
+     * Take a stack for the compartment (recycled if possible) and a slot.
      */
-    code_sz = cheri_align_up(code_sz, sizeof(void *));
-    cmpt_impl_t *impl = (cmpt_impl_t *)cheri_perms_and(cheri_bounds_set_exact(code + code_sz, sizeof(cmpt_impl_t)), RW_PERMS);
-    // Note: just seal it as the object type here is irrelevant
-    // (RB isn't really an appropriate type here because we are not
-    // going to execute this capability).
-    impl->cid = cheri_sentry_create(__cid++); // every compartment gets its unique id
-    impl->target = target;
-    if (flags && !flags->pcc_system_reg) {
-        // note: this requires resealing
-        impl->target = reseal_and_remove_perms(impl->target, PERM_SYS_REG);
-    }
-    if (!cheri_is_sealed(impl->target)) {
-        impl->target = cheri_sentry_create(impl->target);
-    }
-    void *data = _data_allocate();
-    if (data == NULL) {
-        munmap(code, cheri_length_get(code));
+    cmpt_stack_policy_t policy = flags ? flags->stack_policy : CMPT_STACK_LAZY;
+    if (policy >= CMPT_STACK_POLICIES) {
+        errno = EINVAL;
         return NULL;
     }
-    impl->data = (cmpt_data_t *)cheri_perms_and(cheri_bounds_set_exact(data, sizeof(cmpt_data_t)), RWI_PERMS);
-    void *stack = _stack_allocate(stack_pages);
+    void *stack = _stack_get(stack_pages, policy);
     if (stack == NULL) {
-        munmap(code, cheri_length_get(code));
-        munmap(data, cheri_length_get(data));
         return NULL;
     }
-    impl->data->stack = stack; // compartment's (callee's) stack
-    impl->data->cid = NULL; // placeholder for caller CID
+    size_t slot;
+    if (__free_count > 0) {
+        slot = __free[__free_head];
+        __free_head = (__free_head + 1) % CMPT_SLOTS;
+        __free_count--;
+    } else {
+        slot = __next_slot++;
+    }
+    __stacks[slot] = (cmpt_stack_t){ stack, policy };
+
+    /**
+     * Store compartment switch data in the record of the slot.
+     */
+    cmpt_data_t *cmpt = cheri_bounds_set_exact(__data + slot, sizeof(cmpt_data_t));
+    cmpt->stack = stack + cheri_length_get(stack); // compartment's (callee's) stack
+    cmpt->cid = NULL; // placeholder for caller CID
     if (flags && !flags->stack_store_local) {
-        impl->data->stack = cheri_perms_clear(impl->data->stack, PERM_STORE_LOCAL_CAP);
+        cmpt->stack = cheri_perms_clear(cmpt->stack, PERM_STORE_LOCAL_CAP);
     }
     if (flags && !flags->stack_mutable_load) {
-        impl->data->stack = cheri_perms_clear(impl->data->stack, PERM_MUTABLE_LOAD);
+        cmpt->stack = cheri_perms_clear(cmpt->stack, PERM_MUTABLE_LOAD);
+    }
+    // Note: just seal it as the object type here is irrelevant
+    // (RB isn't really an appropriate type here because we are not
+    // going to execute this capability).
+    cmpt->id = cheri_sentry_create(__cid++); // every compartment gets its unique id
+    cmpt->target = target;
+    if (flags && !flags->pcc_system_reg) {
+        // note: this requires resealing
+        cmpt->target = reseal_and_remove_perms(cmpt->target, PERM_SYS_REG);
+    }
+    if (!cheri_is_sealed(cmpt->target)) {
+        cmpt->target = cheri_sentry_create(cmpt->target);
     }
-    impl->data = _bsp_seal_cap(impl->data, impl->cid);
-    impl->entry = _bsp_seal_cap(cheri_perms_and(code + start_offset + 1, RXI_PERMS), impl->cid);
-    impl->exit = _bsp_seal_cap(cheri_perms_and(code + end_offset + 1, RXI_PERMS), impl->cid);
+    cmpt->ret = cheri_sentry_create(stubs + slot * STUB_SIZE + STUB_RET + 1);
+
+    /**
+     * Fill in the slot. No code is written here: the stub
+     * of this slot is already in place. The handle covers
+     * the stubs and slots, and its base is moved down into
+     * the generations area according to the generation.
+     */
+    cmpt_impl_t *impl = (cmpt_impl_t *)__slots + slot;
+    size_t gen_offset = impl->gen * __gen_step;
+    char *handle = cheri_bounds_set_exact(__code + GENS_SPACE - gen_offset, gen_offset + 2 * SLOTS_DIST);
+    handle = cheri_perms_and(handle, RX_PERMS) + gen_offset;
+    impl->data = _bsp_seal_cap(cmpt, cmpt->id);
+    impl->entry = _bsp_seal_cap(cheri_perms_and(code + start_offset + 1, RXI_PERMS), cmpt->id);
+    impl->exit = _bsp_seal_cap(cheri_perms_and(code + end_offset + 1, RXI_PERMS), cmpt->id);
+    impl->base = cheri_base_get(handle);
 
     /**
-     * Fixup memory protection: RW -> RX.
+     * The stub (with LSB set) sealed as a sentry is the result.
      */
-    mprotect(code, code_sz, PROT_READ | PROT_EXEC);
-    __builtin___clear_cache(code, code + code_sz);
+    return (cmpt_fun_t *)cheri_sentry_create(handle + slot * STUB_SIZE + 1);
+}
+
+int destroy_cmpt(cmpt_fun_t *cmpt)
+{
+    size_t slot;
+    if (!_slot_get(cmpt, &slot)) {
+        errno = EINVAL; // not a compartment or already destroyed
+        return -1;
+    }
 
     /**
-     * Correct bounds, permissions and LSB for the result.
-     * Finally, seal it and return a sentry.
+     * Invalidate all handles of this slot, then recycle
+     * its memory and the slot itself.
      */
-    code = cheri_bounds_set_exact(code, code_sz + sizeof(cmpt_impl_t) + sizeof(void *));
-    code = cheri_perms_and(code + 1, RX_PERMS);
-    return cheri_sentry_create(code);
+    cmpt_impl_t *impl = (cmpt_impl_t *)__slots + slot;
+    impl->base = 0;
+    impl->entry = NULL;
+    impl->data = NULL;
+    impl->exit = NULL;
+    impl->gen++;
+    memset(__data + slot, 0, sizeof(cmpt_data_t));
+    _stack_put(&__stacks[slot]);
+    __stacks[slot] = (cmpt_stack_t){ NULL, CMPT_STACK_LAZY };
+    if (impl->gen < __gen_count) {
+        __free[(__free_head + __free_count) % CMPT_SLOTS] = slot;
+        __free_count++;
+    } // otherwise the next generation would match old handles: retire the slot
+    return 0;
 }
 
 void *reseal_and_remove_perms(void *sentry, size_t perms)
@@ -240,55 +630,223 @@ static void *_bsp_seal_cap(const void *cap, const void *cid)
 }
 
 /**
- * Allocates memory enough to save trampoline code and data
- * and returns capability suitable for BSP-sealing as code.
- * May return NULL if memory cannot be allocated.
+ * Maps the shared trampoline code, copies one stub into every slot and
+ * the common code after the slots, and makes the code read-only. This
+ * is the only time the code is written. Returns RX capability suitable
+ * for BSP-sealing as code, or NULL if memory cannot be allocated.
  */
-static void *_exec_allocate()
+static void *_trampoline_allocate()
 {
     size_t pgsz = getpagesize();
+    const char *stub = cheri_align_down(GET_NEAR_ADDR("_cmpt_stub"), 4);
+    const char *common = cheri_align_down(GET_NEAR_ADDR("_cmpt_stub_end"), 4);
+    const char *end = cheri_align_down(GET_NEAR_ADDR("_trampoline_end"), 4);
+    size_t common_sz = end - common;
+    size_t code_sz = cheri_align_up(common_sz, pgsz);
+    size_t sz = GENS_SPACE + 2 * SLOTS_DIST + code_sz;
     int prot = PROT_READ | PROT_WRITE | PROT_CAP_INVOKE | PROT_MAX(PROT_READ | PROT_WRITE | PROT_EXEC);
-    void *mem = mmap(NULL, pgsz, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *mem = mmap(NULL, sz, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (mem == MAP_FAILED) {
         return NULL;
     }
     // Note: setting bounds is going to be redundant here
     // once kernel returns bounded capability.
-    return cheri_bounds_set(mem, pgsz);
+    mem = cheri_bounds_set(mem, sz);
+    char *stubs = mem + GENS_SPACE;
+    for (size_t k = 0; k < CMPT_SLOTS; k++) {
+        memcpy(stubs + k * STUB_SIZE, stub, STUB_SIZE);
+    }
+    memcpy(stubs + 2 * SLOTS_DIST, common, common_sz);
+
+    /**
+     * Fixup memory protection of the stubs and the common code: RW -> RX.
+     * The slots stay writeable, but only via the __slots capability.
+     * The generations area is never accessed.
+     */
+    if (mprotect(mem, GENS_SPACE, PROT_NONE) != 0
+        || mprotect(stubs, SLOTS_DIST, PROT_READ | PROT_EXEC) != 0
+        || mprotect(stubs + 2 * SLOTS_DIST, code_sz, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, sz);
+        return NULL;
+    }
+    __builtin___clear_cache(stubs, stubs + SLOTS_DIST);
+    __builtin___clear_cache(stubs + 2 * SLOTS_DIST, mem + sz);
+    __slots = cheri_perms_and(cheri_bounds_set_exact(stubs + SLOTS_DIST, SLOTS_DIST), RW_PERMS);
+
+    /**
+     * Bases of handles must be aligned enough for the bounds
+     * to be exact even for the longest handle.
+     */
+    __gen_step = ~cheri_representable_alignment_mask(GENS_SPACE + 2 * SLOTS_DIST) + 1;
+    if (__gen_step < sizeof(void *)) {
+        __gen_step = sizeof(void *);
+    }
+    __gen_count = GENS_SPACE / __gen_step;
+    return cheri_perms_and(mem, RXI_PERMS);
 }
 
 /**
- * Allocates memory enough to save writeable data (see cmpt_data_t)
+ * Allocates memory for data of all compartments (see cmpt_data_t)
  * and returns capability suitable for BSP-sealing as data.
  * May return NULL if memory cannot be allocated.
  */
 static void *_data_allocate()
 {
-    size_t pgsz = getpagesize();
+    size_t sz = cheri_align_up(CMPT_SLOTS * sizeof(cmpt_data_t), getpagesize());
     int prot = PROT_READ | PROT_WRITE | PROT_CAP_INVOKE;
-    void *mem = mmap(NULL, pgsz, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *mem = mmap(NULL, sz, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (mem == MAP_FAILED) {
         return NULL;
     }
     // Note: setting bounds is going to be redundant here
     // once kernel returns bounded capability.
-    return cheri_bounds_set(mem, pgsz);
+    return cheri_perms_and(cheri_bounds_set(mem, sz), RWI_PERMS);
 }
 
 /**
- * Allocates given number of pages for compartments stack.
- * Returns valid unsealed capability with its address pointing
- * to its limit.
+ * Reserves memory for compartment stacks. Pages are only
+ * backed by physical memory when they are used. The arena for
+ * huge page stacks is aligned to huge pages, and the whole of it
+ * is marked for transparent huge pages once, so that stacks carved
+ * from it don't split the mapping.
+ * May return NULL if memory cannot be allocated.
  */
-static void *_stack_allocate(unsigned pages)
+static void *_arena_allocate(size_t size, bool huge)
 {
     size_t pgsz = getpagesize();
-    size_t sz = pgsz * pages;
-    void *mem = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    size_t align = huge ? HUGE_PAGE_SIZE : pgsz;
+    size_t sz = cheri_align_up(size, align);
+    char *mem = mmap(NULL, sz + align - pgsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (mem == MAP_FAILED) {
         return NULL;
     }
-    // Note: setting bounds and permissions is going to be
-    // redundant here once kernel returns bounded capability.
-    return cheri_perms_and(cheri_bounds_set(mem, sz), RW_PERMS) + sz;
+    // unmap what is left around the aligned part
+    size_t pad = cheri_align_up(cheri_address_get(mem), align) - cheri_address_get(mem);
+    if (pad > 0) {
+        munmap(mem, pad);
+    }
+    if (align - pgsz > pad) {
+        munmap(mem + pad + sz, align - pgsz - pad);
+    }
+    if (huge) {
+        // only a hint: stacks still work without huge pages
+        madvise(mem + pad, sz, MADV_HUGEPAGE);
+    }
+    // Note: setting bounds is going to be redundant
+    // here once kernel returns bounded capability.
+    return cheri_bounds_set(mem + pad, sz);
+}
+
+/**
+ * Inserts a hole at the given position of the sorted list.
+ */
+static void _hole_insert(cmpt_arena_t *arena, size_t k, size_t offset, size_t size)
+{
+    memmove(&arena->holes[k + 1], &arena->holes[k], (arena->hole_count - k) * sizeof(cmpt_range_t));
+    arena->holes[k] = (cmpt_range_t){ offset, size };
+    arena->hole_count++;
+}
+
+/**
+ * Removes the hole at the given position of the sorted list.
+ */
+static void _hole_remove(cmpt_arena_t *arena, size_t k)
+{
+    arena->hole_count--;
+    memmove(&arena->holes[k], &arena->holes[k + 1], (arena->hole_count - k) * sizeof(cmpt_range_t));
+}
+
+/**
+ * Carves a stack of the given number of pages from the first hole
+ * of the arena where it fits, or from the unused part of the arena.
+ * Huge page stacks come from their own arena, they are aligned to
+ * huge pages and their size is rounded up accordingly. Prefaulted
+ * stacks are populated here. Returns valid unsealed capability
+ * bounded to the stack, or NULL (with errno set to ENOMEM) if the
+ * arena is full.
+ */
+static void *_stack_allocate(unsigned pages, cmpt_stack_policy_t policy)
+{
+    size_t sz = cheri_representable_length((size_t)getpagesize() * pages);
+    size_t align = ~cheri_representable_alignment_mask(sz) + 1;
+    if (policy == CMPT_STACK_HUGE) {
+        sz = cheri_representable_length(cheri_align_up(sz, HUGE_PAGE_SIZE));
+        align = ~cheri_representable_alignment_mask(sz) + 1;
+        align = align < HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : align;
+    }
+    if (pages == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    cmpt_arena_t *arena = policy == CMPT_STACK_HUGE ? &__huge_arena : &__arena;
+    size_t base = cheri_base_get(arena->mem);
+    size_t offset = 0;
+    size_t k = 0;
+    for (; k < arena->hole_count; k++) {
+        offset = cheri_align_up(base + arena->holes[k].offset, align) - base;
+        size_t pad = offset - arena->holes[k].offset;
+        if (pad <= arena->holes[k].size && sz <= arena->holes[k].size - pad) {
+            break;
+        }
+    }
+    if (k < arena->hole_count) {
+        // what is left of the hole on either side of the stack
+        cmpt_range_t hole = arena->holes[k];
+        _hole_remove(arena, k);
+        if (offset + sz < hole.offset + hole.size) {
+            _hole_insert(arena, k, offset + sz, hole.offset + hole.size - offset - sz);
+        }
+        if (offset > hole.offset) {
+            _hole_insert(arena, k, hole.offset, offset - hole.offset);
+        }
+    } else {
+        offset = cheri_align_up(base + arena->used, align) - base;
+        if (offset > cheri_length_get(arena->mem) || sz > cheri_length_get(arena->mem) - offset) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (offset > arena->used) {
+            _hole_insert(arena, arena->hole_count, arena->used, offset - arena->used);
+        }
+        arena->used = offset + sz;
+    }
+    void *stack = cheri_perms_and(cheri_bounds_set_exact(arena->mem + offset, sz), RW_PERMS);
+    if (policy == CMPT_STACK_PREFAULT
+        && madvise(_stack_vmem(stack), sz, MADV_POPULATE_WRITE) != 0) {
+        // older kernels: touch every page
+        memset(stack, 0, sz);
+    }
+    return stack;
+}
+
+/**
+ * Returns the part of the arena taken by a scrubbed stack, merging
+ * it with neighbouring holes or with the unused part of the arena.
+ * Its pages are dropped, so that released prefaulted stacks don't
+ * stay committed.
+ */
+static void _stack_release(void *stack)
+{
+    cmpt_arena_t *arena = _stack_arena(stack);
+    size_t offset = cheri_address_get(stack) - cheri_base_get(arena->mem);
+    size_t sz = cheri_length_get(stack);
+    madvise(_stack_vmem(stack), sz, MADV_DONTNEED);
+    size_t k = 0;
+    while (k < arena->hole_count && arena->holes[k].offset < offset) {
+        k++;
+    }
+    if (k < arena->hole_count && offset + sz == arena->holes[k].offset) {
+        sz += arena->holes[k].size;
+        _hole_remove(arena, k);
+    }
+    if (k > 0 && arena->holes[k - 1].offset + arena->holes[k - 1].size == offset) {
+        offset = arena->holes[--k].offset;
+        sz += arena->holes[k].size;
+        _hole_remove(arena, k);
+    }
+    if (offset + sz == arena->used) {
+        arena->used = offset;
+    } else {
+        _hole_insert(arena, k, offset, sz);
+    }
 }
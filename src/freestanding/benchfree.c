@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "morello.h"
+
+/**
+ * Microbenchmarks for the freestanding library.
+ *
+ * Each benchmark repeats an operation in doubling batches until at
+ * least MIN_TIME_MS have passed according to the generic timer
+ * (CNTVCT_EL0), and prints one CSV line:
+ *
+ *     name,size,align,iterations,ns_per_op,mb_per_s
+ *
+ * where `align` is the misalignment of the destination and the source
+ * (if any) relative to 16 bytes and `mb_per_s` is 0 for operations
+ * that are not about moving bytes. If an argument is given, only
+ * benchmarks with this name are run.
+ */
+
+#define MIN_TIME_MS 20
+#define MAX_SIZE (256ul << 10)
+
+static const size_t sizes[] = { 8, 16, 32, 64, 128, 256, 1024, 4096, 16384, 65536, MAX_SIZE };
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static const struct {
+    size_t dst;
+    size_t src;
+} aligns[] = { { 0, 0 }, { 0, 8 }, { 1, 3 } };
+#define NUM_ALIGNS (sizeof(aligns) / sizeof(aligns[0]))
+
+static uint64_t freq;
+static uint64_t min_ticks;
+static const char *filter;
+
+// Keeps the compiler from moving or dropping the measured operation.
+#define barrier() __asm__ __volatile__ ("" ::: "memory")
+
+#define BENCH(name, size, dalign, salign, op) ({ \
+    uint64_t iters = 0, elapsed = 0, start = cntvct_get(); \
+    for (uint64_t batch = 16; elapsed < min_ticks; batch *= 2) { \
+        for (uint64_t k = 0; k < batch; k++) { \
+            op; \
+            barrier(); \
+        } \
+        iters += batch; \
+        elapsed = cntvct_get() - start; \
+    } \
+    report(name, size, dalign, salign, iters, elapsed); \
+})
+
+static void report(const char *name, size_t size, size_t dalign, size_t salign, uint64_t iters, uint64_t ticks)
+{
+    double ns = (double)ticks * 1e9 / (double)freq / (double)iters;
+    double mbs = size ? (double)size * 1e3 / ns : 0.0;
+    printf("%s,%lu,%lu/%lu,%lu,%.2f,%.1f\n", name, size, dalign, salign, iters, ns, mbs);
+}
+
+static bool enabled(const char *name)
+{
+    return filter == NULL || strcmp(filter, name) == 0;
+}
+
+static void bench_memory(char *dst, char *src)
+{
+    for (size_t a = 0; a < NUM_ALIGNS; a++) {
+        char *d = dst + aligns[a].dst;
+        char *s = src + aligns[a].src;
+        for (size_t k = 0; k < NUM_SIZES; k++) {
+            size_t n = sizes[k];
+            if (enabled("memcpy")) {
+                BENCH("memcpy", n, aligns[a].dst, aligns[a].src, memcpy(d, s, n));
+            }
+            if (enabled("memmove")) {
+                BENCH("memmove", n, aligns[a].dst, aligns[a].src, memmove(s + 1, s, n));
+            }
+            if (enabled("memset")) {
+                BENCH("memset", n, aligns[a].dst, 0ul, memset(d, 'x', n));
+            }
+            if (enabled("memset0")) {
+                BENCH("memset0", n, aligns[a].dst, 0ul, memset(d, 0, n));
+            }
+        }
+    }
+}
+
+static void bench_strings(char *dst, char *src)
+{
+    volatile size_t sink;
+    for (size_t a = 0; a < NUM_ALIGNS; a++) {
+        char *d = dst + aligns[a].dst;
+        char *s = src + aligns[a].src;
+        for (size_t k = 0; k < NUM_SIZES; k++) {
+            size_t n = sizes[k];
+            memset(s, 'a', n - 1);
+            s[n - 1] = '\0';
+            memcpy(d, s, n);
+            if (enabled("strlen")) {
+                BENCH("strlen", n, aligns[a].src, 0ul, sink = strlen(s));
+            }
+            if (enabled("strcmp")) {
+                BENCH("strcmp", n, aligns[a].dst, aligns[a].src, sink = strcmp(d, s));
+            }
+            if (enabled("memchr")) {
+                BENCH("memchr", n, aligns[a].src, 0ul, sink = (size_t)memchr(s, 'b', n));
+            }
+        }
+    }
+    (void)sink;
+}
+
+static void bench_format(char *dst)
+{
+    static const struct {
+        const char *name;
+        const char *fmt;
+    } cases[] = {
+        { "sprintf_d", "%d" },
+        { "sprintf_x", "%#018lx" },
+        { "sprintf_s", "%-24s|" },
+        { "sprintf_f", "%.6f" },
+        { "sprintf_g", "%g" },
+    };
+    char capstr[128];
+    volatile int sink;
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+        const char *fmt = cases[k].fmt;
+        if (!enabled(cases[k].name)) {
+            continue;
+        }
+        switch (fmt[strlen(fmt) - 1]) {
+            case 'd': BENCH(cases[k].name, 0ul, 0ul, 0ul, sink = sprintf(dst, fmt, -1234567)); break;
+            case 'x': BENCH(cases[k].name, 0ul, 0ul, 0ul, sink = sprintf(dst, fmt, 0xdeadbeeful)); break;
+            case '|': BENCH(cases[k].name, 0ul, 0ul, 0ul, sink = sprintf(dst, fmt, "morello")); break;
+            default: BENCH(cases[k].name, 0ul, 0ul, 0ul, sink = sprintf(dst, fmt, 3.14159265358979)); break;
+        }
+    }
+    if (enabled("snprintf_size")) {
+        BENCH("snprintf_size", 0ul, 0ul, 0ul, sink = snprintf(NULL, 0, "%s=%d", "key", 42));
+    }
+    if (enabled("sprintf_p")) {
+        BENCH("sprintf_p", 0ul, 0ul, 0ul, sink = sprintf(dst, "%+#p", dst));
+    }
+    if (enabled("sprint_d")) {
+        BENCH("sprint_d", 0ul, 0ul, 0ul, sink = sprint(dst, -1234567));
+    }
+    if (enabled("sprint_mixed")) {
+        BENCH("sprint_mixed", 0ul, 0ul, 0ul, sink = sprint(dst, "key=", 42, " addr=", print_hex(0xdeadbeeful)));
+    }
+    if (enabled("sprintf_mixed")) {
+        BENCH("sprintf_mixed", 0ul, 0ul, 0ul, sink = sprintf(dst, "key=%d addr=%#lx", 42, 0xdeadbeeful));
+    }
+    if (enabled("sprint_p")) {
+        BENCH("sprint_p", 0ul, 0ul, 0ul, sink = sprint(dst, (void *)dst));
+    }
+    if (enabled("cap_to_str")) {
+        BENCH("cap_to_str", 0ul, 0ul, 0ul, sink = cap_to_str(capstr, dst) != NULL);
+    }
+    (void)sink;
+}
+
+static void bench_init()
+{
+    const startup_profile_t *prof = get_startup_profile();
+    if (enabled("init")) {
+        report("init", 0ul, 0ul, 0ul, 1ul, prof->initialised - prof->start);
+    }
+    if (enabled("relocs") && prof->nrelocs) {
+        // time per relocation
+        report("relocs", 0ul, 0ul, 0ul, prof->nrelocs, prof->relocated - prof->start);
+    }
+}
+
+int main(int argc, char *argv[], char *envp[])
+{
+    freq = cntfrq_get();
+    if (freq == 0ul) {
+        printf("generic timer frequency is unknown\n");
+        return 1;
+    }
+    min_ticks = freq * MIN_TIME_MS / 1000;
+    filter = argc > 1 ? argv[1] : NULL;
+    // room for the largest size, the misalignment and memmove's shift
+    char *dst = malloc(MAX_SIZE + 32);
+    char *src = malloc(MAX_SIZE + 32);
+    if (dst == NULL || src == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+    memset(src, 'a', MAX_SIZE + 32);
+    printf("name,size,align,iterations,ns_per_op,mb_per_s\n");
+    bench_init();
+    bench_memory(dst, src);
+    bench_strings(dst, src);
+    bench_format(dst);
+    free(dst);
+    free(src);
+    return 0;
+}
+
+__attribute__((used))
+void _start(int argc, char *argv[], char *envp[], auxv_t *auxv)
+{
+    init(auxv, false);
+    exit(main(argc, argv, envp));
+}
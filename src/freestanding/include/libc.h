@@ -12,8 +12,61 @@
 #define SYS_EXIT_GROUP 94
 #define SYS_MMAP 222
 #define SYS_WRITE 64
+#define SYS_WRITEV 66
 #define SYS_MPROTECT 226
 #define SYS_MUNMAP 215
+#define SYS_MREMAP 216
+#define SYS_CLOCK_GETTIME 113
+#define SYS_GETTIMEOFDAY 169
+#define SYS_EXIT 93
+#define SYS_FUTEX 98
+#define SYS_CLONE 220
+#define SYS_OPENAT 56
+#define SYS_CLOSE 57
+#define SYS_READ 63
+#define SYS_FSTAT 80
+
+#define MAP_SHARED      0x01
+#define MAP_PRIVATE     0x02
+#define MAP_FIXED       0x10
+#define MAP_ANONYMOUS   0x20
+#define MAP_NORESERVE   0x4000
+#define MAP_POPULATE    0x8000
+
+#define MREMAP_MAYMOVE  1
+
+#define PROT_NONE   0
+#define PROT_READ   1
+#define PROT_WRITE  2
+#define PROT_EXEC   4
+#define PROT_MAX(p) ((p) << 16)
+
+#define O_RDONLY    00
+#define O_WRONLY    01
+#define O_RDWR      02
+#define O_CREAT     0100
+#define O_TRUNC     01000
+#define O_APPEND    02000
+#define O_CLOEXEC   02000000
+#define O_TMPFILE   020040000
+#define AT_FDCWD    -100
+
+#define ENOMEM      12
+#define EFAULT      14
+#define EINVAL      22
+
+#define FUTEX_WAIT          0
+#define FUTEX_WAKE          1
+#define FUTEX_PRIVATE_FLAG  128
+
+#define CLOCK_REALTIME              0
+#define CLOCK_MONOTONIC             1
+#define CLOCK_PROCESS_CPUTIME_ID    2
+#define CLOCK_THREAD_CPUTIME_ID     3
+#define CLOCK_MONOTONIC_RAW         4
+#define CLOCK_REALTIME_COARSE       5
+#define CLOCK_MONOTONIC_COARSE      6
+#define CLOCK_BOOTTIME              7
 
 // Some useful builtins
 #define va_start(v,l)   __builtin_va_start(v,l)
@@ -24,26 +77,274 @@
 #define offsetof(type, member) __builtin_offsetof(type, member)
 #define alignof(type) _Alignof(type)
 
+// Stream buffering modes
+#define _IOFBF 0
+#define _IOLBF 1
+#define _IONBF 2
+#define BUFSIZ 4096
+
+typedef struct stream FILE;
+typedef struct thread thread_t;
+
 // Syscall wrappers
 void exit(int code) __attribute__((noreturn));
 ssize_t write(int fd, const void *buf, size_t count);
-void *mmap(void *addr, size_t len, int prot, int flags);
+ssize_t writev(int fd, const iovec_t *iov, int iovcnt);
+ssize_t read(int fd, void *buf, size_t count);
+int openat(int dirfd, const char *path, int flags, int mode);
+int open(const char *path, int flags);
+int close(int fd);
+int fstat(int fd, stat_t *st);
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, int64_t offset);
 int mprotect(void *addr, size_t len, int prot);
 int munmap(void *addr, size_t len);
+void *mremap(void *addr, size_t old_len, size_t new_len, int flags);
+int futex(int *addr, int op, int val, const timespec_t *timeout);
+
+// Mapped files
+typedef struct {
+    const void *data;   // read-only, bounded to the file size
+    size_t size;        // size of the file
+    void *map;          // owning capability for the mapping
+    size_t map_size;
+} mapped_file_t;
+int map_file(const char *path, mapped_file_t *file);
+int unmap_file(mapped_file_t *file);
+
+// Record reader
+#define READER_BUFSIZE (64ul << 10)
+typedef struct {
+    int fd;
+    int delim;          // record delimiter
+    char *buf;
+    size_t size;        // size of the buffer
+    size_t start;       // start of the first unconsumed record
+    size_t scan;        // data before this offset contains no delimiter
+    size_t end;         // end of data in the buffer
+    bool eof;
+    int error;          // negative error code if reading failed
+} reader_t;
+int reader_init(reader_t *r, int fd, int delim, size_t size);
+const char *reader_next(reader_t *r, size_t *len);
+void reader_free(reader_t *r);
+
+// Growable vectors
+#define VEC_GROW_LIMIT (16ul << 20)
+typedef struct {
+    void *data;         // bounded to `count` elements
+    size_t elem_size;
+    size_t count;       // number of elements in use
+    size_t capacity;    // number of elements that fit in the mapping
+    void *map;          // owning capability for the mapping
+    size_t map_size;
+} vec_t;
+int vec_init(vec_t *v, size_t elem_size, size_t capacity);
+int vec_reserve(vec_t *v, size_t capacity);
+int vec_resize(vec_t *v, size_t count);
+void *vec_push(vec_t *v, const void *elem);
+void vec_free(vec_t *v);
+
+// Sorting and searching
+void qsort(void *base, size_t nmemb, size_t size, int (*compar)(const void *, const void *));
+void *bsearch(const void *key, const void *base, size_t nmemb, size_t size, int (*compar)(const void *, const void *));
+int sort_by_address(void *base, size_t nmemb, size_t size, size_t offset);
 
 // Formatted output
 int printf(const char *fmt, ...);
 int sprintf(char *dst, const char *fmt, ...);
+int snprintf(char *dst, size_t size, const char *fmt, ...);
+int vsnprintf(char *dst, size_t size, const char *fmt, va_list args);
+int vsnprintf_tags(char *dst, size_t size, const char *fmt, va_list args, uint64_t tags);
+
+// Type-driven output: `print(...)` and `sprint(dst, ...)` format each
+// argument according to its static type, like the equivalent `printf`:
+// `%d` and `%u` for integers, `%c` for `char` (but character constants
+// are `int` in C), `%s` for strings and `%+#p` for other pointers;
+// `print_hex(x)` is the same as `%#lx`.
+// There is no format string and no variadic call (up to 16 arguments).
+typedef enum { PRINT_INT, PRINT_UINT, PRINT_HEX, PRINT_CHAR, PRINT_STR, PRINT_CAP } print_type_t;
+typedef struct {
+    print_type_t type;
+    union {
+        int64_t i;
+        uint64_t u;
+        const char *s;
+        const void *p;
+    };
+} print_arg_t;
+int print_args(const print_arg_t *args, size_t count);
+int sprint_args(char *dst, const print_arg_t *args, size_t count);
+
+inline static print_arg_t print_int_arg(int64_t v) { return (print_arg_t){ .type = PRINT_INT, .i = v }; }
+inline static print_arg_t print_uint_arg(uint64_t v) { return (print_arg_t){ .type = PRINT_UINT, .u = v }; }
+inline static print_arg_t print_char_arg(char v) { return (print_arg_t){ .type = PRINT_CHAR, .u = (unsigned char)v }; }
+inline static print_arg_t print_str_arg(const char *v) { return (print_arg_t){ .type = PRINT_STR, .s = v }; }
+inline static print_arg_t print_cap_arg(const void *v) { return (print_arg_t){ .type = PRINT_CAP, .p = v }; }
+inline static print_arg_t print_arg_arg(print_arg_t v) { return v; }
+#define print_hex(x) ((print_arg_t){ .type = PRINT_HEX, .u = (x) })
+
+#define PRINT_ARG(x) _Generic((x), \
+    print_arg_t: print_arg_arg, \
+    char: print_char_arg, \
+    _Bool: print_int_arg, \
+    signed char: print_int_arg, \
+    short: print_int_arg, \
+    int: print_int_arg, \
+    long: print_int_arg, \
+    long long: print_int_arg, \
+    unsigned char: print_uint_arg, \
+    unsigned short: print_uint_arg, \
+    unsigned int: print_uint_arg, \
+    unsigned long: print_uint_arg, \
+    unsigned long long: print_uint_arg, \
+    char *: print_str_arg, \
+    const char *: print_str_arg, \
+    default: print_cap_arg)(x)
+
+#define PRINT_MAP1(x) PRINT_ARG(x)
+#define PRINT_MAP2(x, ...) PRINT_ARG(x), PRINT_MAP1(__VA_ARGS__)
+#define PRINT_MAP3(x, ...) PRINT_ARG(x), PRINT_MAP2(__VA_ARGS__)
+#define PRINT_MAP4(x, ...) PRINT_ARG(x), PRINT_MAP3(__VA_ARGS__)
+#define PRINT_MAP5(x, ...) PRINT_ARG(x), PRINT_MAP4(__VA_ARGS__)
+#define PRINT_MAP6(x, ...) PRINT_ARG(x), PRINT_MAP5(__VA_ARGS__)
+#define PRINT_MAP7(x, ...) PRINT_ARG(x), PRINT_MAP6(__VA_ARGS__)
+#define PRINT_MAP8(x, ...) PRINT_ARG(x), PRINT_MAP7(__VA_ARGS__)
+#define PRINT_MAP9(x, ...) PRINT_ARG(x), PRINT_MAP8(__VA_ARGS__)
+#define PRINT_MAP10(x, ...) PRINT_ARG(x), PRINT_MAP9(__VA_ARGS__)
+#define PRINT_MAP11(x, ...) PRINT_ARG(x), PRINT_MAP10(__VA_ARGS__)
+#define PRINT_MAP12(x, ...) PRINT_ARG(x), PRINT_MAP11(__VA_ARGS__)
+#define PRINT_MAP13(x, ...) PRINT_ARG(x), PRINT_MAP12(__VA_ARGS__)
+#define PRINT_MAP14(x, ...) PRINT_ARG(x), PRINT_MAP13(__VA_ARGS__)
+#define PRINT_MAP15(x, ...) PRINT_ARG(x), PRINT_MAP14(__VA_ARGS__)
+#define PRINT_MAP16(x, ...) PRINT_ARG(x), PRINT_MAP15(__VA_ARGS__)
+#define PRINT_MAP_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, m, ...) m
+#define PRINT_MAP(...) PRINT_MAP_N(__VA_ARGS__, PRINT_MAP16, PRINT_MAP15, PRINT_MAP14, PRINT_MAP13, \
+    PRINT_MAP12, PRINT_MAP11, PRINT_MAP10, PRINT_MAP9, PRINT_MAP8, PRINT_MAP7, PRINT_MAP6, \
+    PRINT_MAP5, PRINT_MAP4, PRINT_MAP3, PRINT_MAP2, PRINT_MAP1)(__VA_ARGS__)
+
+// the array is only evaluated once: `sizeof` doesn't evaluate its operand
+#define PRINT_ARRAY(...) ((const print_arg_t[]){ PRINT_MAP(__VA_ARGS__) })
+#define PRINT_COUNT(...) (sizeof(PRINT_ARRAY(__VA_ARGS__)) / sizeof(print_arg_t))
+#define print(...) print_args(PRINT_ARRAY(__VA_ARGS__), PRINT_COUNT(__VA_ARGS__))
+#define sprint(dst, ...) sprint_args(dst, PRINT_ARRAY(__VA_ARGS__), PRINT_COUNT(__VA_ARGS__))
+
+// Binary logger
+#define LOG_BUFSIZE     (64ul << 10)
+#define LOG_MAX_ARGS    16
+#define LOG_KNOWN_FMTS  64
+typedef struct {
+    uint64_t key;           // address of the format string (0 if unused)
+    uint64_t strings;       // arguments printed with `%s`
+    int state;              // whether the format string is in the file
+} log_format_t;
+typedef struct {
+    union log_slot *buf;    // recorded entries
+    size_t size;            // number of slots in the buffer
+    size_t pos;             // next free slot
+    int fd;                 // file to flush to (-1 for none)
+    size_t dropped;         // entries dropped because the buffer was full
+    log_format_t formats[LOG_KNOWN_FMTS]; // format strings seen so far
+} log_t;
+int log_init(log_t *log, int fd, size_t size);
+void log_printf(log_t *log, const char *fmt, ...);
+void log_vprintf(log_t *log, const char *fmt, va_list args);
+int log_flush(log_t *log);
+void log_free(log_t *log);
+int log_decode(const void *data, size_t size, void (*fn)(void *h, uint64_t time, const char *msg), void *h);
+
+// Memory allocation
+void *malloc(size_t size);
+void *calloc(size_t n, size_t size);
+void *realloc(void *ptr, size_t size);
+void free(void *ptr);
+
+// Output streams
+extern FILE *const stdout;
+int fflush(FILE *stream);
+int setvbuf(FILE *stream, char *buf, int mode, size_t size);
+
+// Runtime tuning (see `init_tuning`)
+typedef struct {
+    size_t zva_size;        // DC ZVA block size (0 if DC ZVA is not used)
+    size_t zva_threshold;   // memset of zeros uses DC ZVA from this size
+} libc_tuning_t;
+void init_tuning();
+const libc_tuning_t *get_libc_tuning();
 
 // String manipulation
 size_t strlen(const char *str);
+size_t strnlen(const char *str, size_t maxlen);
 char *strcpy(char *dst, const char *src);
 int strcmp(const char *lhs, const char *rhs);
+char *strchr(const char *str, int c);
+void *memchr(const void *src, int c, size_t len);
+int memcmp(const void *lhs, const void *rhs, size_t len);
 void *memset(void *dst, int c, size_t len);
 void *memcpy(void *dst, const void *src, size_t len);
+void *mempcpy(void *dst, const void *src, size_t len);
+void *memmove(void *dst, const void *src, size_t len);
+
+// Threads
+#define THREAD_STACK_SIZE   (256ul << 10)
+#define THREAD_TLS_SIZE     256ul
+#define MUTEX_INITIALIZER   { 0 }
+#define COND_INITIALIZER    { 0 }
+#define ONCE_INITIALIZER    { 0 }
+int thread_create(thread_t **thread, void *(*fn)(void *), void *arg, size_t stack_size);
+int thread_join(thread_t *thread, void **result);
+void thread_exit(void *result) __attribute__((noreturn));
+thread_t *thread_self();
+void *thread_tls();
+void mutex_lock(mutex_t *m);
+bool mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+void cond_wait(cond_t *c, mutex_t *m);
+void cond_signal(cond_t *c);
+void cond_broadcast(cond_t *c);
+void once(once_t *o, void (*fn)(void));
 
 // Init things
+#define RELOC_NONE          0
+#define RELOC_RELA_DYN      1
+#define RELOC_CAP_RELOCS    2
+typedef struct {
+    int format;             // one of RELOC_*
+    size_t nrelocs;         // number of processed relocations
+    uint64_t start;         // generic timer count at entry to `init`
+    uint64_t relocated;     // ... after relocations are processed
+    uint64_t initialised;   // ... at exit from `init`
+} startup_profile_t;
 int init(const auxv_t *auxv, bool restricted);
+const startup_profile_t *get_startup_profile();
+void init_vdso(bool restricted);
+void init_threads();
+
+// Time
+int clock_gettime(int clk, timespec_t *ts);
+int gettimeofday(timeval_t *tv, void *tz);
+void *vdso_sym(const char *name);
+
+/**
+ * Returns value of the generic timer virtual count (CNTVCT_EL0).
+ * This counter ticks at a fixed frequency (see `cntfrq_get`) that is
+ * unrelated to the CPU clock, so it counts time, not CPU cycles.
+ */
+inline static uint64_t cntvct_get()
+{
+    uint64_t val;
+    __asm__ __volatile__ ("isb\n" "mrs %0, cntvct_el0\n" : "=r"(val) :: "memory");
+    return val;
+}
+
+/**
+ * Returns frequency of the generic timer in Hz (CNTFRQ_EL0).
+ */
+inline static uint64_t cntfrq_get()
+{
+    uint64_t val;
+    __asm__ ("mrs %0, cntfrq_el0\n" : "=r"(val));
+    return val;
+}
 
 // Auxv access
 void *getauxptr(unsigned long id);
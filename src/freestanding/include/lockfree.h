@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "types.h"
+
+typedef struct lf_node lf_node_t;
+
+/**
+ * Head of a list of nodes together with a generation count. Both are
+ * replaced at once with a compare-and-swap of the capability pair, and
+ * every update increments the generation, so a head that was popped and
+ * pushed back in the meantime (ABA) doesn't match any more.
+ */
+typedef struct {
+    lf_node_t *node;
+    uintptr_t gen;
+} __attribute__((aligned(32))) lf_head_t;
+
+/**
+ * Treiber stack of capabilities with room for `capacity` entries. The
+ * nodes are preallocated and recycled through a second lock-free list,
+ * so neither push nor pop allocates memory.
+ */
+typedef struct {
+    lf_head_t top;
+    lf_head_t free;
+    lf_node_t *nodes;
+} lf_stack_t;
+
+int lf_stack_init(lf_stack_t *s, size_t capacity);
+bool lf_stack_push(lf_stack_t *s, void *cap);
+bool lf_stack_pop(lf_stack_t *s, void **cap);
+void lf_stack_free(lf_stack_t *s);
+
+/**
+ * Bounded multi-producer multi-consumer queue of capabilities (cells
+ * with sequence numbers as described by Dmitry Vyukov). The producer
+ * and consumer positions are kept on separate cache lines.
+ */
+typedef struct {
+    uint64_t seq;
+    void *value;
+} lf_queue_cell_t;
+
+typedef struct {
+    lf_queue_cell_t *cells;
+    size_t mask;
+    size_t head __attribute__((aligned(64)));   // next cell to push to
+    size_t tail __attribute__((aligned(64)));   // next cell to pop from
+} lf_queue_t;
+
+int lf_queue_init(lf_queue_t *q, size_t capacity);
+bool lf_queue_push(lf_queue_t *q, void *cap);
+bool lf_queue_pop(lf_queue_t *q, void **cap);
+void lf_queue_free(lf_queue_t *q);
+
+/**
+ * Atomic capability cell. Only valid (tagged) capabilities can be
+ * published, so a reader never observes a capability that lost its tag.
+ */
+typedef struct {
+    void *cap;
+} lf_cell_t;
+
+bool lf_cell_publish(lf_cell_t *cell, void *cap);
+void *lf_cell_load(lf_cell_t *cell);
+void *lf_cell_take(lf_cell_t *cell);
+bool lf_cell_replace(lf_cell_t *cell, void *expected, void *desired);
@@ -11,8 +11,12 @@
 
 typedef long ssize_t;
 typedef unsigned long size_t;
+typedef signed char int8_t;
+typedef short int16_t;
 typedef int int32_t;
 typedef long int64_t;
+typedef unsigned char uint8_t;
+typedef unsigned short uint16_t;
 typedef unsigned int uint32_t;
 typedef unsigned long uint64_t;
 typedef _Bool bool;
@@ -23,6 +27,52 @@ typedef ssize_t ptrdiff_t;
 #define true 1
 #define false 0
 
+typedef struct {
+    void *iov_base;
+    size_t iov_len;
+} iovec_t;
+
+typedef struct {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+} timespec_t;
+
+typedef struct {
+    int64_t tv_sec;
+    int64_t tv_usec;
+} timeval_t;
+
+typedef struct {
+    uint64_t st_dev;
+    uint64_t st_ino;
+    uint32_t st_mode;
+    uint32_t st_nlink;
+    uint32_t st_uid;
+    uint32_t st_gid;
+    uint64_t st_rdev;
+    uint64_t __pad1;
+    int64_t st_size;
+    int32_t st_blksize;
+    int32_t __pad2;
+    int64_t st_blocks;
+    timespec_t st_atim;
+    timespec_t st_mtim;
+    timespec_t st_ctim;
+    uint32_t __unused[2];
+} stat_t;
+
+typedef struct {
+    int state;
+} mutex_t;
+
+typedef struct {
+    int seq;
+} cond_t;
+
+typedef struct {
+    int state;
+} once_t;
+
 typedef struct {
     uint64_t type;
     union {
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "types.h"
+
+#define SYS_IO_URING_SETUP 425
+#define SYS_IO_URING_ENTER 426
+
+#define IORING_OFF_SQ_RING      0l
+#define IORING_OFF_CQ_RING      0x8000000l
+#define IORING_OFF_SQES         0x10000000l
+
+#define IORING_FEAT_SINGLE_MMAP (1u << 0)
+#define IORING_ENTER_GETEVENTS  (1u << 0)
+
+#define IORING_OP_NOP           0
+#define IORING_OP_READV         1
+#define IORING_OP_WRITEV        2
+#define IORING_OP_READ          22
+#define IORING_OP_WRITE         23
+
+/**
+ * Submission queue entry in the PCuABI layout: pointer-sized fields
+ * hold capabilities, which makes the entry 128 bytes.
+ */
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    union {
+        uint64_t off;
+        void *addr2;
+    };
+    void *addr;
+    uint32_t len;
+    uint32_t rw_flags;
+    void *user_data;
+    uint16_t buf_index;
+    uint16_t personality;
+    int32_t splice_fd_in;
+    void *addr3;
+    uint64_t __pad2[1];
+} io_uring_sqe_t;
+
+/**
+ * Completion queue entry (PCuABI layout).
+ */
+typedef struct {
+    void *user_data;
+    int32_t res;
+    uint32_t flags;
+} io_uring_cqe_t;
+
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t flags;
+    uint32_t dropped;
+    uint32_t array;
+    uint32_t resv1;
+    uint64_t user_addr;
+} io_sqring_offsets_t;
+
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t overflow;
+    uint32_t cqes;
+    uint32_t flags;
+    uint32_t resv1;
+    uint64_t user_addr;
+} io_cqring_offsets_t;
+
+typedef struct {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_thread_cpu;
+    uint32_t sq_thread_idle;
+    uint32_t features;
+    uint32_t wq_fd;
+    uint32_t resv[3];
+    io_sqring_offsets_t sq_off;
+    io_cqring_offsets_t cq_off;
+} io_uring_params_t;
+
+/**
+ * An io_uring instance. All pointers into the shared rings are
+ * bounded to the field or array they refer to.
+ */
+typedef struct {
+    int fd;
+    uint32_t *sq_head;      // consumed by the kernel
+    uint32_t *sq_tail;      // published by us
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    io_uring_sqe_t *sqes;
+    uint32_t sqe_head;      // first prepared entry not yet published
+    uint32_t sqe_tail;      // next entry to prepare
+    uint32_t *cq_head;      // consumed by us
+    uint32_t *cq_tail;      // published by the kernel
+    uint32_t cq_mask;
+    io_uring_cqe_t *cqes;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;           // NULL if shared with the SQ ring
+    size_t cq_map_size;
+    void *sqe_map;
+    size_t sqe_map_size;
+} uring_t;
+
+int uring_init(uring_t *ring, unsigned entries);
+void uring_exit(uring_t *ring);
+io_uring_sqe_t *uring_get_sqe(uring_t *ring);
+void uring_prep_read(io_uring_sqe_t *sqe, int fd, void *buf, size_t len, uint64_t offset, void *user_data);
+void uring_prep_write(io_uring_sqe_t *sqe, int fd, const void *buf, size_t len, uint64_t offset, void *user_data);
+int uring_submit(uring_t *ring, unsigned wait_nr);
+io_uring_cqe_t *uring_peek_cqe(uring_t *ring);
+int uring_wait_cqe(uring_t *ring, io_uring_cqe_t **cqe);
+void uring_cqe_seen(uring_t *ring);
@@ -11,6 +11,7 @@ __attribute__((used))
 void _start(int argc, char *argv[], char *envp[], auxv_t *auxv)
 {
     init(auxv, false);
+    uint64_t now = cntvct_get();
     for (const auxv_t *entry = auxv; entry->type; entry++) {
         const char *name = getauxname(entry->type);
         if (cheri_is_deref(entry->ptr)) {
@@ -19,5 +20,17 @@ void _start(int argc, char *argv[], char *envp[], auxv_t *auxv)
             printf(" %-22s %-2lu %016lx\n", name, entry->type, entry->val);
         }
     }
+    const startup_profile_t *prof = get_startup_profile();
+    static const char *formats[] = { "none", ".rela.dyn", "__cap_relocs" };
+    uint64_t freq = cntfrq_get();
+    if (freq) {
+        printf("startup: %lu relocations (%s) in %lu ns, init %lu ns, total %lu ns\n",
+            prof->nrelocs, formats[prof->format],
+            (prof->relocated - prof->start) * 1000000000ul / freq,
+            (prof->initialised - prof->start) * 1000000000ul / freq,
+            (now - prof->start) * 1000000000ul / freq);
+    }
+    const libc_tuning_t *tun = get_libc_tuning();
+    printf("tuning: DC ZVA block %lu (from %lu bytes)\n", tun->zva_size, tun->zva_threshold);
     exit(0);
 }
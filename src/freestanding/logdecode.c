@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+
+/**
+ * Prints the messages of a binary log written by `log_flush`, one per
+ * entry and optionally prefixed with the time since the first entry:
+ *
+ *     logdecode FILE [-t]
+ */
+
+static uint64_t freq;
+static uint64_t first;
+static bool timestamps;
+
+static void print_msg(void *h, uint64_t time, const char *msg)
+{
+    if (timestamps && freq) {
+        if (first == 0ul) {
+            first = time;
+        }
+        uint64_t ns = (time - first) * 1000000000ul / freq;
+        printf("[%6lu.%06lu] ", ns / 1000000000ul, ns / 1000ul % 1000000ul);
+    }
+    printf("%s", msg);
+}
+
+int main(int argc, char *argv[], char *envp[])
+{
+    if (argc < 2) {
+        printf("usage: %s FILE [-t]\n", argv[0]);
+        return 1;
+    }
+    timestamps = argc > 2 && strcmp(argv[2], "-t") == 0;
+    freq = cntfrq_get();
+    mapped_file_t f;
+    int r = map_file(argv[1], &f);
+    if (r < 0) {
+        printf("%s: cannot map file (%d)\n", argv[1], r);
+        return 1;
+    }
+    r = log_decode(f.data, f.size, print_msg, NULL);
+    unmap_file(&f);
+    if (r < 0) {
+        printf("%s: malformed log\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
+
+__attribute__((used))
+void _start(int argc, char *argv[], char *envp[], auxv_t *auxv)
+{
+    init(auxv, false);
+    exit(main(argc, argv, envp));
+}
@@ -6,11 +6,18 @@
 
 #include "libc.h"
 #include "morello.h"
+#include "lockfree.h"
+#include "uring.h"
 
 static int test_strings(char *argv[], char *envp[]);
 static int test_sprintf(char *argv[], char *envp[]);
 static int test_morello(char *argv[], char *envp[]);
 static int test_memcopy(char *argv[], char *envp[]);
+static int test_stdio(char *argv[], char *envp[]);
+static int test_malloc(char *argv[], char *envp[]);
+static int test_time(char *argv[], char *envp[]);
+static int test_threads(char *argv[], char *envp[]);
+static int test_files(char *argv[], char *envp[]);
 
 int main(int argc, char *argv[], char *envp[])
 {
@@ -19,6 +26,11 @@ int main(int argc, char *argv[], char *envp[])
     r += test_sprintf(argv, envp);
     r += test_morello(argv, envp);
     r += test_memcopy(argv, envp);
+    r += test_stdio(argv, envp);
+    r += test_malloc(argv, envp);
+    r += test_time(argv, envp);
+    r += test_threads(argv, envp);
+    r += test_files(argv, envp);
     if (r) {
         return printf("%d test(s) failed\n", r);
     } else {
@@ -80,6 +92,31 @@ static int test_strings(char *argv[], char *envp[])
         strcmp(buf, "uuuuuuuu") == 0, {});
     TEST(char buf[8]; memset(buf, 'g', 4); memset(buf + 4, 0, 4),
         strcmp(buf, "gggg") == 0, {});
+    TEST(char buf[32] = {0}; memset(cheri_bounds_set_exact(buf, 24), 0x1ff, 100),
+        buf[0] == -1 && buf[23] == -1 && buf[24] == 0, {});
+    TEST(char *big = malloc(20000); memset(big, 'x', 20000); memset(big + 3, 0, 19990),
+        big[2] == 'x' && big[3] == 0 && big[10003] == 0 && big[19992] == 0 && big[19993] == 'x'
+        && memchr(big + 3, 'x', 19990) == NULL, free(big));
+    TEST(const libc_tuning_t *t = get_libc_tuning(),
+        (t->zva_size & (t->zva_size - 1)) == 0, {});
+    TEST(const char str[] = "0123456789abcdefghijklmnopqrstuvwxyz",
+        strlen(str + 3) == 33 && strlen(cheri_bounds_set_exact(str + 1, 20)) == 20, {});
+    TEST(const char str[] = "0123456789abcdefghijklmnopqrstuvwxyz",
+        strnlen(str, 17) == 17 && strnlen(str, 100) == 36, {});
+    TEST({}, strcmp("0123456789abcdefghij", "0123456789abcdefghiJ") > 0, {});
+    TEST({}, strcmp("0123456789abcdef", "0123456789abcdefgh") < 0, {});
+    TEST(const char str[] = "0123456789abcdefghijklmnopqrstuvwxyz",
+        strchr(str, 'x') == str + 33 && strchr(str, '#') == NULL, {});
+    TEST(const char str[] = "0123456789abcdefghijklmnopqrstuvwxyz",
+        strchr(str, '\0') == str + 36 && strchr(cheri_bounds_set_exact(str, 20), 'x') == NULL, {});
+    TEST(const char str[] = "0123456789abcdefghijklmnopqrstuvwxyz",
+        memchr(str, 'k', 36) == str + 20 && memchr(str, 'k', 20) == NULL, {});
+    TEST(const char str[] = "0123456789abcdefghijklmnopqrstuvwxyz",
+        memchr(cheri_bounds_set_exact(str, 10), 'k', 36) == NULL, {});
+    TEST({}, memcmp("0123456789abcdefghij", "0123456789abcdefghiJ", 20) > 0, {});
+    TEST({}, memcmp("0123456789abcdefghij", "0123456789abcdefghiJ", 19) == 0, {});
+    TEST(const char str[] = "0123456789abcdefghijklmnopqrstuvwxyz",
+        memcmp(str + 1, "123456789abcdefghijk", 20) == 0, {});
 
     return r;
 }
@@ -118,7 +155,13 @@ static int test_sprintf(char *argv[], char *envp[])
     STEST("0:0000000000000000:0000000000000000", "%#p", NULL);
     TEST(void *cap = NULL; const char exp[] = "0000000000000000 0 [0000000000000000:0000000000000000) ------------------ none 0 of 0";
         m = sprintf(str, "%+#p", cap), strcmp(str, exp) == 0 && m == (sizeof(exp) - 1), {});
+    STEST("-0000042", "%08d", -42);
+    STEST("  +42|", "%+5d|", 42);
+    STEST("-9223372036854775808", "%ld", -9223372036854775807l - 1);
+    STEST("0x0000beef", "%#010x", 0xbeef);
+    STEST("99 |100|", "%-3u|%lu|", 99, 100ul);
     STEST("     hello", "%10s", "hello");
+    STEST("                                         hello", "%46s", "hello");
     STEST("hello     ", "%-10s", "hello");
     STEST("hello", "%s%n", "hello", &m);
     TEST(int q = 0; sprintf(str, "%-10d%n", 1, &q), q == 10, {});
@@ -126,8 +169,41 @@ static int test_sprintf(char *argv[], char *envp[])
     STEST("mismatch 5 %s %c %u", "mismatch %d %s %c %u", 5);
     STEST("mismatch 5", "mismatch %d", 5, "str", false, 2.71f);
     STEST("unsupported 7 (invalid)", "unsupported %d %s", 7, (char *)42ul);
-    STEST("unsupported 7 %a (invalid)", "unsupported %d %a %s", 7, 99, (char *)42ul);
-    STEST("unsupported -1 %10.4f %-.5e (invalid)", "unsupported %d %10.4f %-.5e %s", -1, 1.2f, 3.14f, "string");
+    STEST("unsupported 7 %o (invalid)", "unsupported %d %o %s", 7, 99, (char *)42ul);
+    STEST("unsupported -1 %10.4k (invalid)", "unsupported %d %10.4k %s", -1, 1.2f, (char *)42ul);
+
+    STEST("-1     1.2000 3.14000e+00 string", "%d %10.4f %-.5e %s", -1, 1.2f, 3.14, "string");
+    STEST("0.100000 1.000000e-01 0.1 0x1.999999999999ap-4", "%f %e %g %a", 0.1, 0.1, 0.1, 0.1);
+    STEST("0.1 1e-01 0.1 0.30000000000000004", "%!f %!e %!g %!g", 0.1, 0.1, 0.1, 0.1 + 0.2);
+    STEST("0.10000000000000000555 0.29999999999999999", "%.20f %.17g", 0.1, 0.3);
+    STEST("0.000000 0.000000e+00 0 0x0p+0", "%.6f %.6e %.6g %a", 0.0, 0.0, 0.0, 0.0);
+    STEST("3.14159 3.142e+00 3.1416", "%.5f %.3e %.5g", 3.14159265, 3.14159265, 3.14159265);
+    STEST("0.12 1.00 2 1e+02", "%.2f %.2f %.0f %.0e", 0.125, 1.005, 2.5, 99.5);
+    STEST("1e+17 1e-05 123456 1.235e+05", "%g %g %g %.4g", 1e17, 1e-5, 123456.0, 123456.0);
+    STEST("-0001.50|+2.5e-01 |  inf|NAN", "%08.2f|%-+9.1e|%5f|%F", -1.5, 0.25, __builtin_inf(), __builtin_nan(""));
+    STEST("0x1.8p+0 0X2P+0 0x1.00p-1022", "%a %.0A %.2a", 1.5, 1.5, 2.2250738585072014e-308);
+    STEST("1.7976931348623157e+308 5e-324", "%!e %!g", 1.7976931348623157e308, 5e-324);
+    STEST("1.797693e+308 4.94066e-324", "%e %g", 1.7976931348623157e308, 5e-324);
+    STEST("[morel] [007] [0x0000ff] [+005    ] []", "[%.5s] [%.3d] [%#.6x] [%-+8.3d] [%.0d]", "morello", 7, 255, 5, 0);
+    TEST(char buf[8], snprintf(buf, sizeof(buf), "%d", 1234567890) == 10 && strcmp(buf, "1234567") == 0, {});
+    TEST(char buf[8], snprintf(buf, 100, "%s|%x", "0123456789", 255) == 13 && strcmp(buf, "0123456") == 0, {});
+    TEST(char buf[8] = "xyz", snprintf(buf, 0, "abc") == 3 && strcmp(buf, "xyz") == 0, {});
+    TEST(char buf[8] = "xyz", snprintf(buf, 1, "abc") == 3 && buf[0] == '\0', {});
+    TEST({}, snprintf(NULL, 0, "%s-%05d", "abc", 42) == 9, {});
+    TEST(char buf[64], snprintf(buf, sizeof(buf), "%10.3f|%-4s|", 3.14159, "ab") == 16
+        && strcmp(buf, "     3.142|ab  |") == 0, printf(" - output: `%s`\n", buf));
+
+    // type-driven print gives the same output as the equivalent printf
+    char ref[256];
+    TEST(int n = sprint(str, "x=", -42, (char)' ', 7u, " y=", -1234567890123l, " z=", 18446744073709551615ul),
+        n == sprintf(ref, "%s%d%c%u%s%ld%s%lu", "x=", -42, ' ', 7u, " y=", -1234567890123l, " z=", 18446744073709551615ul)
+        && strcmp(str, ref) == 0, printf(" - output: `%s`\n", str));
+    TEST(int n = sprint(str, print_hex(0xdeadbeeful), (const char *)NULL, (char *)42ul, (short)-3),
+        n == sprintf(ref, "%#lx%s%s%d", 0xdeadbeeful, (const char *)NULL, (char *)42ul, -3)
+        && strcmp(str, ref) == 0, printf(" - output: `%s`\n", str));
+    TEST(int n = sprint(str, "cap ", argv), n == sprintf(ref, "cap %+#p", argv) && strcmp(str, ref) == 0,
+        printf(" - output: `%s`\n", str));
+    TEST(char buf[8], sprint(buf, "0123456789", 42) == 7 && strcmp(buf, "0123456") == 0, {});
 
     return r;
 }
@@ -157,6 +233,24 @@ static int test_morello(char *argv[], char *envp[])
     return r;
 }
 
+// orders ints as well as structures that start with an int
+static int cmp_first_int(const void *lhs, const void *rhs)
+{
+    int l = *(const int *)lhs, r = *(const int *)rhs;
+    return (l > r) - (l < r);
+}
+
+static bool same_bytes(const void *lhs, const void *rhs, size_t len)
+{
+    const char *l = lhs, *r = rhs;
+    for (size_t k = 0; k < len; k++) {
+        if (l[k] != r[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static int test_memcopy(char *argv[], char *envp[])
 {
     int r = 0;
@@ -191,9 +285,511 @@ static int test_memcopy(char *argv[], char *envp[])
     TEST(memcpy(&d, &s, sizeof(object_t)),
         d.x == 1 && d.y && d.p1 == s.p1 && *d.p2 == x && d.z == -1l, {});
 
+    object_t objs[5] = { s, s, s, s, d };
+    TEST(memmove(&objs[1], &objs[0], 4 * sizeof(object_t)),
+        cheri_tag_get(objs[4].p1) && objs[4].p1 == s.p1 && *objs[4].p2 == x, {});
+    TEST(memmove(&objs[0], &objs[1], 4 * sizeof(object_t)),
+        cheri_tag_get(objs[0].p2) && *objs[0].p2 == x && objs[3].x == 1, {});
+
+    char buf[96];
+    strcpy(buf, src);
+    TEST(memmove(buf + 3, buf, 40), same_bytes(buf + 3, src, 40) && same_bytes(buf, src, 3), {
+        printf("output: `%s`\n", buf);
+    });
+    strcpy(buf, src);
+    TEST(memmove(buf, buf + 7, 50), same_bytes(buf, src + 7, 50), {
+        printf("output: `%s`\n", buf);
+    });
+    strcpy(buf, src);
+    TEST(memmove(buf + 17, buf + 1, 45), same_bytes(buf + 17, src + 1, 45), {
+        printf("output: `%s`\n", buf);
+    });
+    memset(dst, 0, sizeof(dst));
+    TEST(char *e = mempcpy(dst + 3, src + 9, 37),
+        e == dst + 40 && same_bytes(dst + 3, src + 9, 37), {});
+    memset(dst, 0, sizeof(dst));
+    TEST(memcpy(dst + 1, src + 6, 50), same_bytes(dst + 1, src + 6, 50) && dst[0] == 0 && dst[51] == 0, {
+        printf("output: `%s`\n", dst);
+    });
+    TEST(memcpy(dst, cheri_bounds_set_exact(src, 10), 60), same_bytes(dst, src, 10), {});
+
+    // sorting moves structures with capabilities without losing tags
+    object_t many[40];
+    for (int k = 0; k < 40; k++) {
+        many[k] = s;
+        many[k].x = (k * 17) % 40;
+        many[k].p1 = argv[0] + many[k].x;
+    }
+    qsort(many, 40, sizeof(object_t), cmp_first_int);
+    bool sorted = true;
+    for (int k = 0; k < 40; k++) {
+        sorted = sorted && many[k].x == k && cheri_tag_get(many[k].p1) && many[k].p1 == argv[0] + k
+            && cheri_tag_get(many[k].p2) && *many[k].p2 == x;
+    }
+    TEST({}, sorted, {});
+    int key = 23;
+    TEST(object_t *found = bsearch(&key, many, 40, sizeof(object_t), cmp_first_int),
+        found == &many[23] && found->p1 == argv[0] + 23, {});
+    TEST(key = 40, bsearch(&key, many, 40, sizeof(object_t), cmp_first_int) == NULL, {});
+    int nums[5] = { 3, 1, 2, 5, 4 };
+    TEST(qsort(nums, 100, sizeof(int), cmp_first_int), nums[0] == 1 && nums[4] == 5, {}); // count is clamped
+
+    // ... and by the address of a capability field
+    for (int k = 0; k < 40; k++) {
+        many[k].p1 = argv[0] + (k * 13) % 40;
+    }
+    TEST({}, sort_by_address(many, 40, sizeof(object_t), offsetof(object_t, p1)) == 0, {});
+    sorted = true;
+    for (int k = 0; k < 40; k++) {
+        sorted = sorted && many[k].p1 == argv[0] + k && cheri_tag_get(many[k].p1) && cheri_tag_get(many[k].p2);
+    }
+    TEST({}, sorted, {});
+    TEST({}, sort_by_address(many, 40, sizeof(object_t), offsetof(object_t, y)) == -EINVAL, {});
+
+    return r;
+}
+
+static int test_stdio(char *argv[], char *envp[])
+{
+    int r = 0;
+    size_t count = 0;
+    const char name[] = "stdio";
+    char buf[32];
+
+    memset(buf, 0, sizeof(buf));
+    TEST(setvbuf(stdout, buf, _IOFBF, sizeof(buf)); printf("buffered\n"),
+        strcmp(buf, "buffered\n") == 0, {});
+    TEST({}, fflush(stdout) == 0, {});
+    // always switch back to the stream's own buffer: `buf` dies with this frame
+    int restored = setvbuf(stdout, NULL, _IOLBF, 0);
+    TEST({}, restored == 0, {});
+    TEST({}, setvbuf(stdout, NULL, 42, 0) != 0, {});
+    TEST({}, fflush(NULL) == 0, {});
+
     return r;
 }
 
+static int test_malloc(char *argv[], char *envp[])
+{
+    int r = 0;
+    size_t count = 0;
+    const char name[] = "malloc";
+
+    char *p = malloc(10);
+    TEST({}, cheri_tag_get(p) && cheri_length_get(p) == 10, {});
+    TEST({}, !cheri_check_perms(p, PERM_EXECUTE) && !cheri_check_perms(p, PERM_SYS_REG), {});
+    TEST(strcpy(p, "morello"), strcmp(p, "morello") == 0, {});
+    char *q = malloc(10);
+    TEST({}, cheri_tag_get(q) && q != p, {});
+    free(p);
+    char *p2 = malloc(16);
+    TEST({}, cheri_address_get(p2) == cheri_address_get(p), {});
+    free(p2);
+    free(q);
+    TEST(free(q), malloc(10) != malloc(10), {}); // second free is ignored
+    TEST(free(p + 1), true, {}); // interior pointer is ignored
+    TEST(free(argv[0]), true, {}); // foreign pointer is ignored
+
+    long *z = calloc(100, sizeof(long));
+    bool zeros = z != NULL;
+    for (size_t k = 0; zeros && k < 100; k++) {
+        zeros = z[k] == 0;
+    }
+    TEST({}, zeros && cheri_length_get(z) == 100 * sizeof(long), {});
+    TEST({}, calloc(~0ul / 2, 4) == NULL, {});
+
+    char *big = malloc(100000);
+    TEST({}, cheri_tag_get(big) && cheri_length_get(big) >= 100000, {});
+    TEST(memset(big, 'x', 100000), big[99999] == 'x', {});
+
+    char **v = malloc(4 * sizeof(char *));
+    for (size_t k = 0; k < 4; k++) {
+        v[k] = argv[0];
+    }
+    TEST(v = realloc(v, 1000 * sizeof(char *)),
+        cheri_length_get(v) == 1000 * sizeof(char *) && cheri_tag_get(v[3]) && v[3] == argv[0], {});
+    TEST(v = realloc(v, 8 * sizeof(char *)),
+        cheri_length_get(v) == 8 * sizeof(char *) && v[0] == argv[0], {});
+    TEST(big = realloc(big, 200000), cheri_length_get(big) >= 200000 && big[99999] == 'x', {});
+    free(v);
+    free(big);
+    TEST({}, malloc(0) == NULL, {});
+    TEST({}, malloc((size_t)getpagesize() << 28) == NULL, {});
+    TEST({}, realloc(NULL, 20) != NULL, {});
+
+    // a vector of capabilities grown well past the doubling phase
+    vec_t vec;
+    TEST({}, vec_init(&vec, sizeof(char *), 0) == 0 && vec.count == 0 && vec.capacity > 0, {});
+    size_t n = 4 * VEC_GROW_LIMIT / sizeof(char *);
+    bool pushed = true;
+    for (size_t k = 0; pushed && k < n; k++) {
+        char *e = argv[0] + (k & 7);
+        pushed = vec_push(&vec, &e) != NULL;
+    }
+    TEST({}, pushed && vec.count == n && cheri_length_get(vec.data) == n * sizeof(char *), {});
+    char **caps = vec.data;
+    bool tagged = true;
+    for (size_t k = 0; tagged && k < n; k++) {
+        tagged = cheri_tag_get(caps[k]) && caps[k] == argv[0] + (k & 7);
+    }
+    TEST({}, tagged, {});
+    TEST({}, !cheri_check_perms(vec.data, PERM_VMEM) && vec.map_size <= 6 * VEC_GROW_LIMIT, {});
+    TEST({}, vec_resize(&vec, 4) == 0 && cheri_length_get(vec.data) == 4 * sizeof(char *), {});
+    TEST({}, vec_resize(&vec, 6) == 0 && ((char **)vec.data)[5] == NULL && ((char **)vec.data)[3] == argv[0] + 3, {});
+    TEST({}, vec_reserve(&vec, ~0ul / 4) < 0 && vec.count == 6, {});
+    vec_free(&vec);
+    TEST({}, vec.data == NULL && vec.capacity == 0, {});
+
+    return r;
+}
+
+static int test_time(char *argv[], char *envp[])
+{
+    int r = 0;
+    size_t count = 0;
+    const char name[] = "time";
+
+    timespec_t t0, t1;
+    TEST({}, clock_gettime(CLOCK_MONOTONIC, &t0) == 0, {});
+    TEST({}, clock_gettime(CLOCK_MONOTONIC, &t1) == 0, {});
+    TEST({}, t1.tv_sec > t0.tv_sec || (t1.tv_sec == t0.tv_sec && t1.tv_nsec >= t0.tv_nsec), {});
+    TEST({}, t0.tv_nsec >= 0 && t0.tv_nsec < 1000000000, {});
+    TEST({}, clock_gettime(CLOCK_REALTIME, &t0) == 0 && t0.tv_sec > 1600000000, {});
+    timeval_t tv;
+    TEST({}, gettimeofday(&tv, NULL) == 0 && tv.tv_sec >= t0.tv_sec && tv.tv_usec < 1000000, {});
+    TEST({}, clock_gettime(CLOCK_MONOTONIC, cheri_bounds_set_exact(&t0, 8)) < 0, {});
+    TEST({}, clock_gettime(-100, &t0) < 0, {});
+    TEST({}, vdso_sym("no_such_function") == NULL, {});
+    TEST(uint64_t c0 = cntvct_get(); uint64_t c1 = cntvct_get(), c1 >= c0, {});
+    TEST({}, cntfrq_get() > 0, {});
+
+    return r;
+}
+
+static mutex_t test_mutex = MUTEX_INITIALIZER;
+static cond_t test_cond = COND_INITIALIZER;
+static once_t test_once = ONCE_INITIALIZER;
+static int test_counter, test_onces, test_ready;
+
+static void test_once_fn()
+{
+    test_onces++;
+}
+
+static void *test_worker(void *arg)
+{
+    once(&test_once, test_once_fn);
+    for (int k = 0; k < 10000; k++) {
+        mutex_lock(&test_mutex);
+        test_counter++;
+        mutex_unlock(&test_mutex);
+    }
+    char *p = malloc(100);
+    sprintf(thread_tls(), "%p", arg);
+    free(p);
+    mutex_lock(&test_mutex);
+    test_ready++;
+    cond_broadcast(&test_cond);
+    mutex_unlock(&test_mutex);
+    return arg + 1;
+}
+
+#define LF_ROUNDS 20000
+#define LF_ITEMS 10000
+
+static lf_stack_t lf_stack;
+static lf_queue_t lf_queue;
+static char lf_items[2][LF_ITEMS];
+static unsigned char lf_seen[2][LF_ITEMS];
+static int lf_bad, lf_popped;
+
+static void *lf_stack_worker(void *arg)
+{
+    // every thread holds at most one token, so the stack is never empty
+    for (int k = 0; k < LF_ROUNDS; k++) {
+        void *token;
+        if (!lf_stack_pop(&lf_stack, &token) || !cheri_tag_get(token) || !lf_stack_push(&lf_stack, token)) {
+            __atomic_add_fetch(&lf_bad, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return arg;
+}
+
+static void *lf_producer(void *arg)
+{
+    char *items = arg;
+    for (int k = 0; k < LF_ITEMS; k++) {
+        while (!lf_queue_push(&lf_queue, &items[k])) {
+        }
+    }
+    return arg;
+}
+
+static void *lf_consumer(void *arg)
+{
+    while (__atomic_load_n(&lf_popped, __ATOMIC_RELAXED) < 2 * LF_ITEMS) {
+        char *item;
+        if (!lf_queue_pop(&lf_queue, (void **)&item)) {
+            continue;
+        }
+        __atomic_add_fetch(&lf_popped, 1, __ATOMIC_RELAXED);
+        size_t p = item >= lf_items[1];
+        if (!cheri_tag_get(item) || cheri_length_get(item) != LF_ITEMS) {
+            __atomic_add_fetch(&lf_bad, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&lf_seen[p][item - lf_items[p]], 1, __ATOMIC_RELAXED);
+        }
+    }
+    return arg;
+}
+
+static int test_threads(char *argv[], char *envp[])
+{
+    int r = 0;
+    size_t count = 0;
+    const char name[] = "threads";
+
+    TEST({}, thread_self() != NULL && cheri_length_get(thread_tls()) == THREAD_TLS_SIZE, {});
+    thread_t *t[4];
+    int created = 0;
+    for (int k = 0; k < 4; k++) {
+        created += thread_create(&t[k], test_worker, argv[0] + k, k * 8192) == 0;
+    }
+    TEST({}, created == 4, {});
+    mutex_lock(&test_mutex);
+    while (test_ready < created) {
+        cond_wait(&test_cond, &test_mutex);
+    }
+    mutex_unlock(&test_mutex);
+    TEST({}, test_ready == 4, {});
+    bool joined = true;
+    for (int k = 0; k < created; k++) {
+        void *res = NULL;
+        joined = joined && thread_join(t[k], &res) == 0 && res == argv[0] + k + 1;
+    }
+    TEST({}, joined, {});
+    TEST({}, test_counter == 40000, printf(" - counter: %d\n", test_counter));
+    TEST({}, test_onces == 1, {});
+    TEST({}, mutex_trylock(&test_mutex) && !mutex_trylock(&test_mutex), {});
+    mutex_unlock(&test_mutex);
+
+    // lock-free stack: LIFO order, tags kept, bounded capacity
+    void *v[3] = { NULL, NULL, NULL };
+    TEST({}, lf_stack_init(&lf_stack, 8) == 0, {});
+    TEST({}, !lf_stack_pop(&lf_stack, &v[0]), {});
+    TEST({}, lf_stack_push(&lf_stack, argv[0]) && lf_stack_push(&lf_stack, (void *)42ul), {});
+    TEST({}, lf_stack_pop(&lf_stack, &v[0]) && lf_stack_pop(&lf_stack, &v[1]), {});
+    TEST({}, !cheri_tag_get(v[0]) && cheri_address_get(v[0]) == 42ul && v[1] == argv[0] && cheri_tag_get(v[1])
+        && cheri_length_get(v[1]) == cheri_length_get(argv[0]), {});
+    // ABA: the same node is on top again, but with another generation
+    lf_stack_push(&lf_stack, argv[0]);
+    lf_stack_push(&lf_stack, (void *)argv);
+    lf_head_t snap = lf_stack.top;
+    lf_stack_pop(&lf_stack, &v[0]);
+    lf_stack_pop(&lf_stack, &v[1]);
+    lf_stack_push(&lf_stack, v[0]);
+    TEST({}, lf_stack.top.node == snap.node && lf_stack.top.gen != snap.gen, {});
+    lf_stack_pop(&lf_stack, &v[0]);
+    int pushed = 0;
+    while (lf_stack_push(&lf_stack, argv[0] + pushed)) {
+        pushed++;
+    }
+    TEST({}, pushed == 8, {});
+    TEST({}, lf_stack_pop(&lf_stack, &v[0]) && v[0] == argv[0] + 7, {});
+    lf_stack_push(&lf_stack, v[0]);
+    lf_bad = 0;
+    created = 0;
+    for (int k = 0; k < 4; k++) {
+        created += thread_create(&t[k], lf_stack_worker, NULL, 0) == 0;
+    }
+    for (int k = 0; k < created; k++) {
+        thread_join(t[k], NULL);
+    }
+    // every token is still there exactly once
+    int tokens = 0, distinct = 0;
+    while (lf_stack_pop(&lf_stack, &v[0])) {
+        distinct |= 1 << ((char *)v[0] - argv[0]);
+        tokens++;
+    }
+    TEST({}, created == 4 && lf_bad == 0 && tokens == 8 && distinct == 0xff,
+        printf(" - bad: %d, tokens: %d\n", lf_bad, tokens));
+    lf_stack_free(&lf_stack);
+
+    // lock-free queue: FIFO order, full and empty queues, concurrent use
+    TEST({}, lf_queue_init(&lf_queue, 3) == 0 && lf_queue.mask == 3ul, {});
+    TEST({}, lf_queue_push(&lf_queue, argv[0]) && lf_queue_push(&lf_queue, (void *)42ul)
+        && lf_queue_push(&lf_queue, (void *)argv) && lf_queue_push(&lf_queue, NULL) && !lf_queue_push(&lf_queue, argv[0]), {});
+    TEST({}, lf_queue_pop(&lf_queue, &v[0]) && lf_queue_pop(&lf_queue, &v[1]) && lf_queue_pop(&lf_queue, &v[2])
+        && v[0] == argv[0] && cheri_tag_get(v[0]) && !cheri_tag_get(v[1]) && v[2] == (void *)argv, {});
+    TEST({}, lf_queue_pop(&lf_queue, &v[0]) && v[0] == NULL && !lf_queue_pop(&lf_queue, &v[0]), {});
+    lf_queue_free(&lf_queue);
+    TEST({}, lf_queue_init(&lf_queue, 64) == 0, {});
+    lf_bad = lf_popped = 0;
+    created = 0;
+    for (int k = 0; k < 2; k++) {
+        created += thread_create(&t[k], lf_producer, cheri_bounds_set(lf_items[k], LF_ITEMS), 0) == 0;
+        created += thread_create(&t[k + 2], lf_consumer, NULL, 0) == 0;
+    }
+    for (int k = 0; k < created; k++) {
+        thread_join(t[k], NULL);
+    }
+    int once_each = 0;
+    for (int k = 0; k < 2 * LF_ITEMS; k++) {
+        once_each += lf_seen[k / LF_ITEMS][k % LF_ITEMS] == 1;
+    }
+    TEST({}, created == 4 && lf_bad == 0 && once_each == 2 * LF_ITEMS,
+        printf(" - bad: %d, delivered once: %d\n", lf_bad, once_each));
+    lf_queue_free(&lf_queue);
+
+    // capability cell: only tagged capabilities are published
+    lf_cell_t cell = { NULL };
+    TEST({}, !lf_cell_publish(&cell, (void *)42ul) && lf_cell_load(&cell) == NULL, {});
+    TEST({}, lf_cell_publish(&cell, argv[0]) && lf_cell_load(&cell) == argv[0], {});
+    TEST({}, !lf_cell_replace(&cell, (void *)argv, argv[0]) && !lf_cell_replace(&cell, argv[0], cheri_tag_clear(argv)), {});
+    TEST({}, lf_cell_replace(&cell, argv[0], (void *)argv) && lf_cell_take(&cell) == (void *)argv && lf_cell_take(&cell) == NULL, {});
+
+    return r;
+}
+
+typedef struct {
+    char **argv;
+    int count;
+    int same;
+} log_check_t;
+
+static void check_log_msg(void *h, uint64_t time, const char *msg)
+{
+    log_check_t *c = h;
+    char str[256];
+    int k = c->count++;
+    sprintf(str, "%d %s %#p %+#p|%5.2f\n", k, c->argv[0], c->argv[0], c->argv, 2.5 * k);
+    c->same += strcmp(str, msg) == 0;
+}
+
+static int test_files(char *argv[], char *envp[])
+{
+    int r = 0;
+    size_t count = 0;
+    const char name[] = "files";
+
+    TEST({}, open("/nonexistent/file", O_RDONLY) < 0, {});
+    TEST(char path[4] = "abcd", open(path, O_RDONLY) == -EFAULT, {});
+    char head[16] = {0};
+    int fd = open(argv[0], O_RDONLY);
+    TEST({}, fd >= 0 && read(fd, head, sizeof(head)) == sizeof(head), {});
+    stat_t st;
+    TEST({}, fstat(fd, &st) == 0 && st.st_size > 16, {});
+    TEST({}, close(fd) == 0 && close(fd) < 0, {});
+    mapped_file_t f;
+    TEST({}, map_file(argv[0], &f) == 0 && f.size == (size_t)st.st_size, {});
+    TEST({}, memcmp(f.data, head, sizeof(head)) == 0 && memcmp(f.data, "\x7f" "ELF", 4) == 0, {});
+    TEST({}, cheri_length_get(f.data) == cheri_representable_length(f.size)
+        && !cheri_check_perms(f.data, PERM_STORE) && !cheri_check_perms(f.data, PERM_VMEM), {});
+    TEST({}, unmap_file(&f) == 0 && f.data == NULL, {});
+    TEST({}, map_file("/nonexistent/file", &f) < 0, {});
+
+    // records of the same file read with a tiny and a default buffer
+    size_t records[2] = {0}, bytes[2] = {0};
+    bool bounded = true;
+    for (int k = 0; k < 2; k++) {
+        reader_t rd;
+        fd = open(argv[0], O_RDONLY);
+        if (fd < 0 || reader_init(&rd, fd, '\n', k ? 0 : 16) != 0) {
+            break;
+        }
+        size_t len;
+        for (const char *rec; (rec = reader_next(&rd, &len)) != NULL; records[k]++, bytes[k] += len) {
+            bounded = bounded && cheri_length_get(rec) >= len && memchr(rec, '\n', len) == NULL
+                && !cheri_check_perms(rec, PERM_STORE);
+        }
+        TEST({}, rd.error == 0, {});
+        reader_free(&rd);
+        close(fd);
+    }
+    TEST({}, records[0] > 0 && records[0] == records[1] && bytes[0] == bytes[1]
+        && bytes[0] + records[0] >= (size_t)st.st_size, {});
+    TEST({}, bounded, {});
+
+    // io_uring may be disabled in the kernel: skip these tests then
+    uring_t ring;
+    int ur = uring_init(&ring, 8);
+    if (ur == 0 && (fd = open(argv[0], O_RDONLY)) >= 0) {
+        char expect[64], buf[4][16];
+        TEST({}, read(fd, expect, sizeof(expect)) == sizeof(expect), {});
+        for (int k = 0; k < 4; k++) {
+            io_uring_sqe_t *sqe = uring_get_sqe(&ring);
+            TEST({}, sqe != NULL && cheri_length_get(sqe) == sizeof(io_uring_sqe_t), {});
+            // the length is clamped to the bounds of the buffer
+            char *b = cheri_bounds_set(buf[k], 16);
+            uring_prep_read(sqe, fd, b, 100, 16 * k, b);
+            TEST({}, sqe->len == 16, {});
+        }
+        TEST({}, uring_submit(&ring, 4) == 4, {});
+        int done = 0;
+        io_uring_cqe_t *cqe;
+        for (int k = 0; k < 4 && uring_wait_cqe(&ring, &cqe) == 0; k++) {
+            char *b = cqe->user_data;
+            done += cqe->res == 16 && memcmp(b, expect + (b - buf[0]), 16) == 0;
+            uring_cqe_seen(&ring);
+        }
+        TEST({}, done == 4, printf(" - completed: %d\n", done));
+        TEST({}, uring_peek_cqe(&ring) == NULL, {});
+        close(fd);
+        uring_exit(&ring);
+    } else {
+        printf("Test %s skipped io_uring: %d\n", name, ur);
+    }
+
+    // binary log in an unnamed temporary file, flushed several times
+    log_t log;
+    fd = openat(AT_FDCWD, "/tmp", O_RDWR | O_TMPFILE, 0600);
+    if (fd >= 0 && log_init(&log, fd, 64 * sizeof(void *)) == 0) {
+        for (int k = 0; k < 20; k++) {
+            // strings are copied when recorded, so the buffer can be reused
+            char tmp[256];
+            strcpy(tmp, argv[0]);
+            log_printf(&log, "%d %s %#p %+#p|%5.2f\n", k, tmp, argv[0], argv, 2.5 * k);
+            memset(tmp, 'x', strlen(tmp));
+        }
+        TEST({}, log.dropped == 0 && log.pos < 20 * 7, {});
+        log_free(&log);
+        TEST({}, fstat(fd, &st) == 0 && st.st_size > 0, {});
+        const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        log_check_t check = { .argv = argv, .count = 0, .same = 0 };
+        TEST({}, log_decode(data, st.st_size, check_log_msg, &check) == 20 && check.same == 20,
+            printf(" - decoded: %d, same: %d\n", check.count, check.same));
+        TEST({}, log_decode(data, st.st_size - 1, check_log_msg, &check) < 0, {});
+        munmap((void *)data, st.st_size);
+        close(fd);
+    } else {
+        printf("Test %s skipped binary log: %d\n", name, fd);
+    }
+
+    // format strings of a failed flush are written by the next one
+    fd = openat(AT_FDCWD, "/tmp", O_RDWR | O_TMPFILE, 0600);
+    int ro = open(argv[0], O_RDONLY);
+    if (fd >= 0 && ro >= 0 && log_init(&log, ro, 0) == 0) {
+        const char *fmt = "%d %s %#p %+#p|%5.2f\n";
+        log_printf(&log, fmt, 0, argv[0], argv[0], argv, 0.0);
+        TEST({}, log_flush(&log) < 0, {});
+        log.fd = fd;
+        log_printf(&log, fmt, 0, argv[0], argv[0], argv, 0.0);
+        log_free(&log);
+        TEST({}, fstat(fd, &st) == 0 && st.st_size > 0, {});
+        const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        log_check_t check = { .argv = argv, .count = 0, .same = 0 };
+        TEST({}, log_decode(data, st.st_size, check_log_msg, &check) == 1 && check.same == 1, {});
+        munmap((void *)data, st.st_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (ro >= 0) {
+        close(ro);
+    }
+
+    return r;
+}
 
 __attribute__((used))
 void _start(int argc, char *argv[], char *envp[], auxv_t *auxv)
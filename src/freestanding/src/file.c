@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "morello.h"
+
+/**
+ * Maps the whole file at `path` read-only and describes it in `file`.
+ * `file->data` is a capability with only load permission bounded to
+ * the file contents, so the file can be used in place without
+ * copying. The file descriptor is closed before returning. Returns 0
+ * on success or negative error code.
+ *
+ * If the file size is not representable as exact bounds, the bounds
+ * are rounded up and the mapping is extended with anonymous zero pages
+ * to cover them: reading past the end of a file mapping would raise
+ * SIGBUS rather than a capability fault.
+ */
+int map_file(const char *path, mapped_file_t *file)
+{
+    if (cheri_get_tail(file) < sizeof(mapped_file_t)) {
+        return -EFAULT;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return fd;
+    }
+    stat_t st;
+    int r = fstat(fd, &st);
+    if (r < 0) {
+        close(fd);
+        return r;
+    }
+    file->data = NULL;
+    file->size = st.st_size;
+    file->map = NULL;
+    file->map_size = 0ul;
+    if (file->size == 0ul) {
+        close(fd);
+        return 0;
+    }
+    size_t pgsz = getpagesize();
+    size_t file_pages = (file->size + pgsz - 1) & ~(pgsz - 1);
+    size_t map_size = (cheri_representable_length(file->size) + pgsz - 1) & ~(pgsz - 1);
+    void *map;
+    if (map_size > file_pages) {
+        // reserve the whole range and place the file at its start
+        map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (cheri_tag_get(map)) {
+            void *m = mmap(map, file_pages, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+            if (!cheri_tag_get(m)) {
+                munmap(map, map_size);
+                map = m;
+            }
+        }
+    } else {
+        map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (!cheri_tag_get(map)) {
+        return (int)cheri_address_get(map);
+    }
+    file->map = map;
+    file->map_size = map_size;
+    file->data = cheri_perms_and(cheri_bounds_set(map, file->size), PERM_GLOBAL | PERM_LOAD);
+    return 0;
+}
+
+/**
+ * Unmaps a file mapped by `map_file`. All capabilities derived from
+ * `file->data` become unusable.
+ */
+int unmap_file(mapped_file_t *file)
+{
+    if (!cheri_is_deref(file) || file->map == NULL) {
+        return 0;
+    }
+    int r = munmap(file->map, file->map_size);
+    file->data = NULL;
+    file->map = NULL;
+    file->size = file->map_size = 0ul;
+    return r;
+}
@@ -23,38 +23,43 @@ typedef struct {
     p; \
 })
 
-__attribute__((unused))
-static int init_cap_relocs(const auxv_t *auxv)
+/**
+ * Finds the RW and RX root capabilities for the executable.
+ */
+static bool find_roots(const auxv_t *auxv, void **rw, void **rx)
 {
-    const cap_relocs_entry_t *cap_start = __get_addr_of("__cap_relocs_start");
-    const cap_relocs_entry_t *cap_end = __get_addr_of("__cap_relocs_end");
-    if (cap_end == cap_start || cap_start == NULL || cap_end == NULL) {
-        return 1;
-    }
-    void *rw = NULL;
-    void *rx = NULL;
+    *rw = NULL;
+    *rx = NULL;
     for (; auxv->type; auxv++) {
         switch (auxv->type) {
-            case AT_CHERI_EXEC_RW_CAP: rw = auxv->ptr; break;
-            case AT_CHERI_EXEC_RX_CAP: rx = auxv->ptr; break;
+            case AT_CHERI_EXEC_RW_CAP: *rw = auxv->ptr; break;
+            case AT_CHERI_EXEC_RX_CAP: *rx = auxv->ptr; break;
         }
-        if (rw && rx) break;
-    }
-    if (!rw || !rx) {
-        return 2;
+        if (*rw && *rx) break;
     }
+    return *rw && *rx;
+}
+
+/**
+ * Processes the `__cap_relocs` table (deprecated format). Each entry
+ * has its own permission mask, but consecutive entries usually share
+ * it, so the derived root is reused while the mask does not change.
+ * Returns number of processed entries.
+ */
+static size_t init_cap_relocs(const cap_relocs_entry_t *cap_start, const cap_relocs_entry_t *cap_end,
+    void *rw, void *rx, size_t clrperm)
+{
+    size_t n = 0, last_perm = 0;
+    void *root = NULL;
     for (const cap_relocs_entry_t *r = cap_start; r < cap_end; r++) {
         if (!r->base) continue;
-        void *cap = NULL;
         size_t perm = ~r->permissions;
         bool is_fun_ptr = perm & PERM_EXECUTE;
-        bool is_writable = perm & PERM_STORE;
-        if (is_writable) {
-            cap = cheri_address_set(rw, r->base);
-        } else {
-            cap = cheri_address_set(rx, r->base);
+        if (root == NULL || perm != last_perm) {
+            root = cheri_perms_and((perm & PERM_STORE) ? rw : rx, is_fun_ptr ? perm & ~clrperm : perm);
+            last_perm = perm;
         }
-        cap = cheri_perms_and(cap, perm);
+        void *cap = cheri_address_set(root, r->base);
         cap = cheri_bounds_set_exact(cap, r->size);
         cap = cheri_offset_set(cap, r->offset);
         if (is_fun_ptr) {
@@ -64,8 +69,9 @@ static int init_cap_relocs(const auxv_t *auxv)
         void **loc = cheri_address_set(rw, r->location);
         loc = cheri_bounds_set_exact(loc, sizeof(void *));
         *loc = cap;
+        n++;
     }
-    return 0;
+    return n;
 }
 
 typedef struct {
@@ -86,74 +92,103 @@ typedef struct {
 
 #define R_MORELLO_RELATIVE 59395
 
-static int init_morello_relative(const auxv_t *auxv, size_t clrperm)
+/**
+ * Processes `R_MORELLO_RELATIVE` entries in `.rela.dyn`. The root
+ * for each of the permission classes is derived once up front, so
+ * each relocation only needs to set the address and bounds. Returns
+ * number of processed entries.
+ */
+static size_t init_morello_relative(const rela_t *rela_start, const rela_t *rela_end,
+    void *rw, void *rx, size_t clrperm)
 {
-    const rela_t *rela_start = __get_addr_of("__rela_dyn_start");
-    const rela_t *rela_end = __get_addr_of("__rela_dyn_end");
-    if (rela_start == rela_end || rela_start == NULL || rela_end == NULL) {
-        return 1;
-    }
-    void *rw = NULL;
-    void *rx = NULL;
-    for (; auxv->type; auxv++) {
-        switch (auxv->type) {
-            case AT_CHERI_EXEC_RW_CAP: rw = auxv->ptr; break;
-            case AT_CHERI_EXEC_RX_CAP: rx = auxv->ptr; break;
-        }
-        if (rw && rx) break;
-    }
-    if (!rw || !rx) {
-        return 2;
+    void *roots[8];
+    for (size_t k = 0; k < 8; k++) {
+        roots[k] = cheri_perms_and(rx, 0);
     }
+    roots[MORELLO_RELA_PERM_R] = cheri_perms_and(rx, PERM_GLOBAL | READ_CAP_PERMS);
+    roots[MORELLO_RELA_PERM_RW] = cheri_perms_and(rw, PERM_GLOBAL | READ_CAP_PERMS | WRITE_CAP_PERMS);
+    roots[MORELLO_RELA_PERM_RX] = cheri_perms_and(rx, (PERM_GLOBAL | READ_CAP_PERMS | EXEC_CAP_PERMS) & ~clrperm);
+    size_t n = 0;
     for (const rela_t *r = rela_start; r < rela_end; r++) {
         if (r->r_info != R_MORELLO_RELATIVE) continue;
-        void *cap = NULL, **loc = cheri_address_set(rw, r->r_offset);
+        void **loc = cheri_address_set(rw, r->r_offset);
         const cap_rela_t *u = (cap_rela_t *)loc;
-        switch (u->perms) {
-            case MORELLO_RELA_PERM_R:
-                cap = cheri_perms_and(rx, PERM_GLOBAL | READ_CAP_PERMS);
-                break;
-            case MORELLO_RELA_PERM_RW:
-                cap = cheri_perms_and(rw, PERM_GLOBAL | READ_CAP_PERMS | WRITE_CAP_PERMS);
-                break;
-            case MORELLO_RELA_PERM_RX:
-                cap = cheri_perms_and(rx, PERM_GLOBAL | READ_CAP_PERMS | EXEC_CAP_PERMS);
-                break;
-            default:
-                cap = cheri_perms_and(rx, 0);
-                break;
-        }
-        cap = cheri_address_set(cap, u->address);
+        size_t perms = u->perms;
+        void *cap = cheri_address_set(roots[perms < 8 ? perms : 0], u->address);
         cap = cheri_bounds_set_exact(cap, u->length);
         cap = cap + r->r_addend;
-        if (u->perms == MORELLO_RELA_PERM_RX) {
-            if (clrperm) {
-                cap = cheri_perms_and(cap, ~clrperm);
-            }
+        if (perms == MORELLO_RELA_PERM_RX) {
             cap = cheri_sentry_create(cap);
         }
         *loc = cap;
+        n++;
     }
-    return 0;
+    return n;
 }
 
 static auxv_t __auxv[AT_ENUM_MAX];
+static startup_profile_t __profile;
 
+/**
+ * Initialises the runtime: processes capability relocations emitted
+ * by the linker (either `.rela.dyn` or `__cap_relocs`, whichever is
+ * present), stores the auxiliary vector, selects the DC ZVA threshold
+ * of `memset` and sets up threads and the vDSO. Returns
+ * non-zero if relocations could not be processed.
+ */
 int init(const auxv_t *auxv, bool restricted)
 {
+    // globals can't be accessed until relocations are processed
+    uint64_t start = cntvct_get();
     size_t clrperm = restricted ? (PERM_EXECUTIVE | PERM_SYS_REG) : 0ul;
-    int r = init_morello_relative(auxv, clrperm);
-    if (r != 0) {
-        return r;
+    const rela_t *rela_start = __get_addr_of("__rela_dyn_start");
+    const rela_t *rela_end = __get_addr_of("__rela_dyn_end");
+    const cap_relocs_entry_t *cap_start = __get_addr_of("__cap_relocs_start");
+    const cap_relocs_entry_t *cap_end = __get_addr_of("__cap_relocs_end");
+    bool has_rela = rela_start != NULL && rela_end != NULL && rela_start != rela_end;
+    bool has_cap_relocs = cap_start != NULL && cap_end != NULL && cap_start != cap_end;
+    size_t nrelocs = 0;
+    int format = RELOC_NONE;
+    if (has_rela || has_cap_relocs) {
+        void *rw, *rx;
+        if (!find_roots(auxv, &rw, &rx)) {
+            return 2;
+        }
+        if (has_rela) {
+            nrelocs = init_morello_relative(rela_start, rela_end, rw, rx, clrperm);
+            format = RELOC_RELA_DYN;
+        } else {
+            nrelocs = init_cap_relocs(cap_start, cap_end, rw, rx, clrperm);
+            format = RELOC_CAP_RELOCS;
+        }
     }
+    uint64_t relocated = cntvct_get();
     for (const auxv_t *entry = auxv; entry->type; entry++) {
         auxv_t *p = &__auxv[entry->type];
         p->type = entry->type;
         p->ptr = entry->ptr;
     }
+    init_tuning();
+    init_threads();
+    init_vdso(restricted);
+    __profile.format = format;
+    __profile.nrelocs = nrelocs;
+    __profile.start = start;
+    __profile.relocated = relocated;
+    __profile.initialised = cntvct_get();
     return 0;
 }
 
+/**
+ * Returns startup profile: times (in generic timer ticks, see
+ * `cntfrq_get`) of the start of `init`, the end of relocation
+ * processing and the end of `init`.
+ */
+const startup_profile_t *get_startup_profile()
+{
+    return &__profile;
+}
+
 void *getauxptr(unsigned long id)
 {
     if (id < AT_ENUM_MAX) {
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "lockfree.h"
+#include "morello.h"
+
+/**
+ * Lock-free containers of capabilities.
+ *
+ * Capabilities are only ever copied with capability loads, stores and
+ * compare-and-swap instructions, so they keep their tags when they are
+ * passed from one thread to another.
+ */
+
+struct lf_node {
+    lf_node_t *next;
+    void *value;
+};
+
+/**
+ * Compare-and-swap of a list head: a single CASPAL of the capability
+ * pair (node, generation) with acquire and release semantics.
+ */
+static bool head_cas(lf_head_t *head, lf_head_t expected, lf_head_t desired)
+{
+    register void *c0 __asm__("c0") = expected.node;
+    register uintptr_t c1 __asm__("c1") = expected.gen;
+    register void *c2 __asm__("c2") = desired.node;
+    register uintptr_t c3 __asm__("c3") = desired.gen;
+    __asm__ __volatile__ ("caspal c0, c1, c2, c3, [%2]\n"
+        : "+C"(c0), "+C"(c1) : "C"(head), "C"(c2), "C"(c3) : "memory");
+    return c0 == expected.node && c1 == expected.gen;
+}
+
+static lf_head_t head_load(lf_head_t *head)
+{
+    // the two halves may be torn, but then the CAS fails
+    lf_head_t h;
+    h.gen = __atomic_load_n(&head->gen, __ATOMIC_ACQUIRE);
+    h.node = __atomic_load_n(&head->node, __ATOMIC_ACQUIRE);
+    return h;
+}
+
+static void list_push(lf_head_t *head, lf_node_t *node)
+{
+    for (;;) {
+        lf_head_t old = head_load(head);
+        node->next = old.node;
+        if (head_cas(head, old, (lf_head_t){ node, old.gen + 1 })) {
+            return;
+        }
+    }
+}
+
+/**
+ * Pops a node. Nodes are never freed while the stack exists, so
+ * reading `next` of a node that was taken by another thread is safe:
+ * the value read is stale, and the CAS fails because the generation
+ * has changed.
+ */
+static lf_node_t *list_pop(lf_head_t *head)
+{
+    for (;;) {
+        lf_head_t old = head_load(head);
+        if (old.node == NULL) {
+            return NULL;
+        }
+        lf_node_t *next = __atomic_load_n(&old.node->next, __ATOMIC_RELAXED);
+        if (head_cas(head, old, (lf_head_t){ next, old.gen + 1 })) {
+            return old.node;
+        }
+    }
+}
+
+/**
+ * Initialises stack `s` with room for `capacity` capabilities. Returns 0
+ * on success or negative error code.
+ */
+int lf_stack_init(lf_stack_t *s, size_t capacity)
+{
+    // CASPAL needs the pair to be aligned to its size
+    if (cheri_get_tail(s) < sizeof(lf_stack_t) || (cheri_address_get(s) & (sizeof(lf_head_t) - 1)) || capacity == 0ul) {
+        return -EINVAL;
+    }
+    s->nodes = calloc(capacity, sizeof(lf_node_t));
+    if (s->nodes == NULL) {
+        return -ENOMEM;
+    }
+    s->top = (lf_head_t){ NULL, 0 };
+    s->free = (lf_head_t){ NULL, 0 };
+    for (size_t k = 0; k < capacity; k++) {
+        s->nodes[k].next = k + 1 < capacity ? &s->nodes[k + 1] : NULL;
+    }
+    s->free.node = s->nodes;
+    return 0;
+}
+
+/**
+ * Pushes `cap` onto the stack. Returns false if the stack is full.
+ */
+bool lf_stack_push(lf_stack_t *s, void *cap)
+{
+    lf_node_t *node = list_pop(&s->free);
+    if (node == NULL) {
+        return false;
+    }
+    node->value = cap;
+    list_push(&s->top, node);
+    return true;
+}
+
+/**
+ * Pops the most recently pushed capability into `cap`. Returns false if
+ * the stack is empty.
+ */
+bool lf_stack_pop(lf_stack_t *s, void **cap)
+{
+    lf_node_t *node = list_pop(&s->top);
+    if (node == NULL) {
+        return false;
+    }
+    *cap = node->value;
+    list_push(&s->free, node);
+    return true;
+}
+
+/**
+ * Frees the nodes. No other thread may use the stack any more.
+ */
+void lf_stack_free(lf_stack_t *s)
+{
+    free(s->nodes);
+    s->nodes = NULL;
+    s->top = s->free = (lf_head_t){ NULL, 0 };
+}
+
+/**
+ * Initialises queue `q` with room for `capacity` capabilities (rounded
+ * up to a power of two). Returns 0 on success or negative error code.
+ */
+int lf_queue_init(lf_queue_t *q, size_t capacity)
+{
+    if (cheri_get_tail(q) < sizeof(lf_queue_t) || capacity == 0ul || capacity > (1ul << 32)) {
+        return -EINVAL;
+    }
+    size_t n = 1;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    q->cells = calloc(n, sizeof(lf_queue_cell_t));
+    if (q->cells == NULL) {
+        return -ENOMEM;
+    }
+    for (size_t k = 0; k < n; k++) {
+        q->cells[k].seq = k;
+    }
+    q->mask = n - 1;
+    q->head = q->tail = 0ul;
+    return 0;
+}
+
+/**
+ * Appends `cap` to the queue. Returns false if the queue is full.
+ */
+bool lf_queue_push(lf_queue_t *q, void *cap)
+{
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for (;;) {
+        lf_queue_cell_t *cell = &q->cells[pos & q->mask];
+        int64_t diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            // the cell is free: claim it
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->value = cap;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            // the cell still holds the value pushed one round ago
+            return false;
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Removes the oldest capability from the queue and stores it in `cap`.
+ * Returns false if the queue is empty.
+ */
+bool lf_queue_pop(lf_queue_t *q, void **cap)
+{
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        lf_queue_cell_t *cell = &q->cells[pos & q->mask];
+        int64_t diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *cap = cell->value;
+                cell->value = NULL;
+                __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            // nothing has been pushed to this cell yet
+            return false;
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void lf_queue_free(lf_queue_t *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+    q->mask = q->head = q->tail = 0ul;
+}
+
+/**
+ * Stores `cap` in the cell with release semantics. Untagged
+ * capabilities are rejected (and false is returned).
+ */
+bool lf_cell_publish(lf_cell_t *cell, void *cap)
+{
+    if (!cheri_tag_get(cap)) {
+        return false;
+    }
+    __atomic_store_n(&cell->cap, cap, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Returns the capability in the cell (NULL if there is none).
+ */
+void *lf_cell_load(lf_cell_t *cell)
+{
+    return __atomic_load_n(&cell->cap, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Takes the capability out of the cell, leaving NULL behind, so that
+ * only one thread can receive it.
+ */
+void *lf_cell_take(lf_cell_t *cell)
+{
+    return __atomic_exchange_n(&cell->cap, NULL, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Replaces `expected` with `desired` if the cell still holds
+ * `expected`. Untagged `desired` capabilities are rejected.
+ */
+bool lf_cell_replace(lf_cell_t *cell, void *expected, void *desired)
+{
+    if (!cheri_tag_get(desired)) {
+        return false;
+    }
+    return __atomic_compare_exchange_n(&cell->cap, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "morello.h"
+
+/**
+ * Binary logger.
+ *
+ * `log_printf` doesn't format anything: it stores the format string
+ * capability, a timestamp and the raw variadic argument slots in the
+ * log's buffer. Every slot is copied as a capability, so capability
+ * arguments keep their tags and nothing depends on the conversions
+ * used. Strings passed to `%s` are copied into the buffer after the
+ * slots, so they may be changed or freed once `log_printf` returns.
+ * Each format string is parsed only once to find them: the result
+ * is kept in the log's table of formats.
+ * A log is meant to be used by one thread only (each thread records
+ * into its own log), so recording takes no locks.
+ *
+ * `log_flush` writes the buffer to the log's file in bulk. Each
+ * argument is written as its tag and its 128-bit value, followed by
+ * the copied strings, and every format string is written once, the
+ * first time it is used. When the buffer is full, it is flushed
+ * automatically (or the new entry is dropped if the log has no file
+ * or the entry doesn't fit into an empty buffer).
+ *
+ * `log_decode` reads such a file and formats the entries with the
+ * usual `printf` rules, printing the recorded tags for `%#p` and
+ * `%+#p`. At most LOG_MAX_ARGS arguments are recorded per entry.
+ *
+ * File format (64-bit little-endian words, records padded to 8 bytes):
+ *
+ *     LOG_STR:   type | len << 32, key, bytes...
+ *     LOG_ENTRY: type | nargs << 32, key, time, tags, strings,
+ *                nargs * (address, high), for each string: len, bytes...
+ *
+ * where `key` identifies the format string and bit k in `tags` and
+ * `strings` tells whether argument k was tagged and printed with `%s`.
+ */
+
+union log_slot {
+    const void *cap;
+    struct {
+        uint64_t time;
+        uint32_t nargs;
+        uint32_t nstrs;     // slots taken by copies of strings
+    } hdr;
+};
+
+#define LOG_STR     1ul
+#define LOG_ENTRY   2ul
+
+#define FMT_NEW         0   // format string not written yet
+#define FMT_FLUSHING    1   // written by the flush in progress
+#define FMT_WRITTEN     2   // format string is in the file
+
+/**
+ * Initialises `log` with a buffer of `size` bytes (LOG_BUFSIZE if 0)
+ * that is flushed to `fd` (or never, if `fd` is negative). Returns 0 on
+ * success or negative error code.
+ */
+int log_init(log_t *log, int fd, size_t size)
+{
+    if (cheri_get_tail(log) < sizeof(log_t)) {
+        return -EFAULT;
+    }
+    size_t min = (2 + LOG_MAX_ARGS) * sizeof(union log_slot);
+    log->buf = malloc(size < min ? (size ? min : LOG_BUFSIZE) : size);
+    if (log->buf == NULL) {
+        return -ENOMEM;
+    }
+    log->size = cheri_length_get(log->buf) / sizeof(union log_slot);
+    log->pos = 0ul;
+    log->fd = fd;
+    log->dropped = 0ul;
+    memset(log->formats, 0, sizeof(log->formats));
+    return 0;
+}
+
+/**
+ * Returns a mask of the arguments printed with `s` by `fmt`, following
+ * the parsing rules of `printf_core`.
+ */
+static uint64_t string_args(const char *fmt)
+{
+    const char *limit = (char *)cheri_get_limit(fmt);
+    uint64_t mask = 0ul;
+    size_t k = 0;
+    bool format = false;
+    for (const char *p = fmt; p < limit && *p != '\0'; p++) {
+        if (!format) {
+            format = *p == '%';
+        } else if (*p == '%') {
+            format = false;
+        } else if (strchr("0123456789.-+ #!lzt", *p) == NULL) {
+            if (strchr("scnpxuidfFeEgGaA", *p) != NULL) {
+                mask |= *p == 's' && k < 64 ? 1ul << k : 0ul;
+                k++;
+            }
+            format = false;
+        }
+    }
+    return mask;
+}
+
+/**
+ * Finds the format string `fmt` in the table of formats seen by the log,
+ * and adds it (with the mask of its `%s` arguments) if it is new, so
+ * that the format is only parsed once. Returns NULL if the table is full.
+ */
+static log_format_t *log_format(log_t *log, const char *fmt)
+{
+    uint64_t key = cheri_address_get(fmt);
+    for (size_t k = 0, i = (key >> 4) % LOG_KNOWN_FMTS; k < LOG_KNOWN_FMTS; k++, i = (i + 1) % LOG_KNOWN_FMTS) {
+        log_format_t *f = &log->formats[i];
+        if (f->key == key) {
+            return f;
+        } else if (f->key == 0ul) {
+            *f = (log_format_t){ .key = key, .strings = string_args(fmt), .state = FMT_NEW };
+            return f;
+        }
+    }
+    return NULL;
+}
+
+void log_vprintf(log_t *log, const char *fmt, va_list args)
+{
+    const void *const *va = (const void *const *)(void *)args;
+    size_t nargs = va == NULL ? 0ul : cheri_get_tail(va) / sizeof(void *);
+    if (nargs > LOG_MAX_ARGS) {
+        nargs = LOG_MAX_ARGS;
+    }
+    if (!cheri_tag_get(fmt)) {
+        log->dropped++;
+        return;
+    }
+    // strings to copy, with their terminators, rounded up to slots
+    const log_format_t *f = log_format(log, fmt);
+    uint64_t strings = (f ? f->strings : string_args(fmt)) & ((1ul << nargs) - 1);
+    size_t lens[LOG_MAX_ARGS];
+    size_t nstrs = 0;
+    for (size_t k = 0; k < nargs; k++) {
+        if ((strings & (1ul << k)) && cheri_is_deref(va[k])) {
+            lens[k] = strlen(va[k]);
+            nstrs += lens[k] / sizeof(union log_slot) + 1;
+        } else {
+            strings &= ~(1ul << k);
+        }
+    }
+    size_t n = 2 + nargs + nstrs;
+    if (log->pos + n > log->size) {
+        if (log->fd < 0 || n > log->size || log_flush(log) < 0) {
+            log->dropped++;
+            return;
+        }
+    }
+    union log_slot *e = log->buf + log->pos;
+    e[0].cap = fmt;
+    e[1].hdr.time = cntvct_get();
+    e[1].hdr.nargs = nargs;
+    e[1].hdr.nstrs = nstrs;
+    char *copy = (char *)(e + 2 + nargs);
+    for (size_t k = 0; k < nargs; k++) {
+        if (strings & (1ul << k)) {
+            memcpy(copy, va[k], lens[k]);
+            copy[lens[k]] = '\0';
+            e[2 + k].cap = cheri_bounds_set(copy, lens[k] + 1);
+            copy += (lens[k] / sizeof(union log_slot) + 1) * sizeof(union log_slot);
+        } else {
+            e[2 + k].cap = va[k];
+        }
+    }
+    log->pos += n;
+}
+
+/**
+ * Records an entry to be formatted later by `log_decode`. Format
+ * strings must stay valid until the log is flushed, while strings
+ * passed to `%s` are copied.
+ */
+void log_printf(log_t *log, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    log_vprintf(log, fmt, args);
+    va_end(args);
+}
+
+typedef struct {
+    int fd;
+    int error;
+    size_t pos;
+    char buf[4096];
+} log_writer_t;
+
+static void writer_flush(log_writer_t *w, const void *data, size_t len)
+{
+    while (len > 0ul && w->error == 0) {
+        ssize_t n = write(w->fd, data, len);
+        if (n <= 0) {
+            w->error = n < 0 ? (int)n : -EFAULT;
+        } else {
+            data += n;
+            len -= n;
+        }
+    }
+}
+
+static void writer_put(log_writer_t *w, const void *data, size_t len)
+{
+    if (w->pos + len > sizeof(w->buf)) {
+        writer_flush(w, w->buf, w->pos);
+        w->pos = 0ul;
+        if (len > sizeof(w->buf)) {
+            writer_flush(w, data, len);
+            return;
+        }
+    }
+    memcpy(w->buf + w->pos, data, len);
+    w->pos += len;
+}
+
+static void writer_word(log_writer_t *w, uint64_t word)
+{
+    writer_put(w, &word, sizeof(word));
+}
+
+static void writer_bytes(log_writer_t *w, const char *str, size_t len)
+{
+    static const char zeros[8] = {0};
+    writer_put(w, str, len);
+    writer_put(w, zeros, -len & 7ul);
+}
+
+/**
+ * Writes all recorded entries to the log's file and empties the
+ * buffer. Format strings only count as written if the whole flush
+ * succeeds, so they are written again by the next flush after an
+ * error. Returns 0 on success or negative error code.
+ */
+int log_flush(log_t *log)
+{
+    if (log->fd < 0) {
+        return -EFAULT;
+    }
+    log_writer_t w = { .fd = log->fd, .error = 0, .pos = 0ul };
+    for (size_t pos = 0; pos < log->pos;) {
+        union log_slot *e = log->buf + pos;
+        const char *fmt = e[0].cap;
+        size_t nargs = e[1].hdr.nargs;
+        size_t nstrs = e[1].hdr.nstrs;
+        uint64_t key = cheri_address_get(fmt);
+        log_format_t *f = log_format(log, fmt);
+        if (f == NULL || f->state == FMT_NEW) {
+            // table is full: write the string again
+            size_t len = strlen(fmt);
+            writer_word(&w, LOG_STR | len << 32);
+            writer_word(&w, key);
+            writer_bytes(&w, fmt, len);
+            if (f != NULL) {
+                f->state = FMT_FLUSHING;
+            }
+        }
+        uint64_t tags = 0ul, strings = f ? f->strings : string_args(fmt);
+        for (size_t k = 0; k < nargs; k++) {
+            tags |= (uint64_t)cheri_tag_get(e[2 + k].cap) << k;
+            if (!cheri_is_deref(e[2 + k].cap)) {
+                strings &= ~(1ul << k);
+            }
+        }
+        writer_word(&w, LOG_ENTRY | nargs << 32);
+        writer_word(&w, key);
+        writer_word(&w, e[1].hdr.time);
+        writer_word(&w, tags);
+        writer_word(&w, strings & ((1ul << nargs) - 1));
+        for (size_t k = 0; k < nargs; k++) {
+            writer_word(&w, cheri_address_get(e[2 + k].cap));
+            writer_word(&w, cheri_copy_from_high(e[2 + k].cap));
+        }
+        for (size_t k = 0; k < nargs; k++) {
+            if (strings & (1ul << k)) {
+                size_t len = strlen(e[2 + k].cap);
+                writer_word(&w, len);
+                writer_bytes(&w, e[2 + k].cap, len);
+            }
+        }
+        pos += 2 + nargs + nstrs;
+    }
+    writer_flush(&w, w.buf, w.pos);
+    for (size_t k = 0; k < LOG_KNOWN_FMTS; k++) {
+        if (log->formats[k].state == FMT_FLUSHING) {
+            log->formats[k].state = w.error == 0 ? FMT_WRITTEN : FMT_NEW;
+        }
+    }
+    log->pos = 0ul;
+    return w.error;
+}
+
+/**
+ * Flushes the log (if it has a file) and frees its buffer.
+ */
+void log_free(log_t *log)
+{
+    if (log->fd >= 0) {
+        log_flush(log);
+    }
+    free(log->buf);
+    log->buf = NULL;
+    log->size = log->pos = 0ul;
+}
+
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t pos;
+} log_input_t;
+
+static bool input_word(log_input_t *in, uint64_t *word)
+{
+    if (in->size - in->pos < sizeof(uint64_t)) {
+        return false;
+    }
+    memcpy(word, in->data + in->pos, sizeof(uint64_t));
+    in->pos += sizeof(uint64_t);
+    return true;
+}
+
+/**
+ * Returns a read-only capability for `len` bytes of input, which
+ * string functions can use without a NUL terminator.
+ */
+static const char *input_bytes(log_input_t *in, size_t len)
+{
+    size_t padded = (len + 7ul) & ~7ul;
+    if (padded < len || in->size - in->pos < padded) {
+        return NULL;
+    }
+    const char *p = in->data + in->pos;
+    in->pos += padded;
+    if (cheri_representable_length(len) == len && !(cheri_address_get(p) & ~cheri_representable_alignment_mask(len))) {
+        p = cheri_bounds_set_exact(p, len);
+    } else {
+        p = cheri_bounds_set(p, len);
+    }
+    return cheri_perms_and(p, PERM_GLOBAL | PERM_LOAD);
+}
+
+typedef struct {
+    uint64_t key;
+    const char *str;
+} log_fmt_t;
+
+static const char *find_fmt(vec_t *fmts, uint64_t key)
+{
+    log_fmt_t *f = fmts->data;
+    for (size_t k = fmts->count; k > 0; k--) {
+        if (f[k - 1].key == key) {
+            return f[k - 1].str;
+        }
+    }
+    return NULL;
+}
+
+static int decode_entry(log_input_t *in, vec_t *fmts, size_t nargs, char **msg, size_t *msg_size,
+    void (*fn)(void *h, uint64_t time, const char *msg), void *h)
+{
+    uint64_t key, time, tags, strings;
+    if (nargs > LOG_MAX_ARGS || !input_word(in, &key) || !input_word(in, &time)
+        || !input_word(in, &tags) || !input_word(in, &strings)) {
+        return -1;
+    }
+    const char *fmt = find_fmt(fmts, key);
+    if (fmt == NULL) {
+        return -1;
+    }
+    // argument slots laid out as `va_list` expects them
+    void *slots[LOG_MAX_ARGS];
+    for (size_t k = 0; k < nargs; k++) {
+        uint64_t value[2];
+        if (!input_word(in, &value[0]) || !input_word(in, &value[1])) {
+            return -1;
+        }
+        memcpy(&slots[k], value, sizeof(value)); // untagged
+    }
+    for (size_t k = 0; k < nargs; k++) {
+        if (strings & (1ul << k)) {
+            uint64_t len;
+            if (!input_word(in, &len) || (slots[k] = (void *)input_bytes(in, len)) == NULL) {
+                return -1;
+            }
+        }
+    }
+    void *va = nargs ? cheri_bounds_set_exact(slots, nargs * sizeof(void *)) : NULL;
+    va_list args;
+    static_assert(sizeof(va_list) == sizeof(void *), "va_list is a capability");
+    *(void **)&args = va;
+    int n = vsnprintf_tags(*msg, *msg_size, fmt, args, tags);
+    if (n >= 0 && (size_t)n >= *msg_size) {
+        char *m = realloc(*msg, n + 1);
+        if (m == NULL) {
+            return -1;
+        }
+        *msg = m;
+        *msg_size = n + 1;
+        *(void **)&args = va;
+        vsnprintf_tags(*msg, *msg_size, fmt, args, tags);
+    }
+    fn(h, time, *msg);
+    return 0;
+}
+
+/**
+ * Formats the entries of a log file (`data` being its contents) and
+ * passes each message and its timestamp (generic timer count) to `fn`.
+ * Returns the number of entries or -1 if the data is malformed.
+ */
+int log_decode(const void *data, size_t size, void (*fn)(void *h, uint64_t time, const char *msg), void *h)
+{
+    log_input_t in = { .data = data, .size = size, .pos = 0ul };
+    size_t msg_size = 256;
+    char *msg = malloc(msg_size);
+    vec_t fmts;
+    if (cheri_get_tail(data) < size || msg == NULL || vec_init(&fmts, sizeof(log_fmt_t), 0) < 0) {
+        free(msg);
+        return -1;
+    }
+    int r = 0;
+    for (uint64_t word; r >= 0 && input_word(&in, &word);) {
+        size_t len = word >> 32;
+        uint64_t key;
+        if ((word & 0xfffffffful) == LOG_STR && input_word(&in, &key)) {
+            log_fmt_t f = { .key = key, .str = input_bytes(&in, len) };
+            r = f.str != NULL && vec_push(&fmts, &f) != NULL ? r : -1;
+        } else if ((word & 0xfffffffful) == LOG_ENTRY) {
+            r = decode_entry(&in, &fmts, len, &msg, &msg_size, fn, h) < 0 ? -1 : r + 1;
+        } else {
+            r = -1;
+        }
+    }
+    vec_free(&fmts);
+    free(msg);
+    return r;
+}
@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "morello.h"
+
+/**
+ * A simple heap allocator built on top of `mmap`.
+ *
+ * Memory is reserved in large arenas (one `mmap` each). Pages of an
+ * arena are only backed by physical memory when touched, so the size
+ * of the reservation does not affect memory usage. The allocator keeps
+ * the owning capability of each arena (the one with the `VMEM` perm)
+ * and derives all capabilities from it, so any capability returned to
+ * the user can be mapped back to the arena it came from.
+ *
+ * Small objects (up to MAX_SMALL bytes) are allocated from slabs: page
+ * runs of SLAB_PAGES pages split into slots of the same size class.
+ * Free slots are kept in a singly linked list per size class. Larger
+ * objects get their own page runs. Freed page runs are kept in a list
+ * and reused by later allocations (first fit).
+ *
+ * Each arena starts with a page map: one 32-bit entry per page that
+ * records what the page is used for (see PAGE_* below). It is used to
+ * validate pointers passed to `free` and `realloc`. The page map is
+ * followed by a free map with one bit per 16-byte granule, which is set
+ * for slots in the free lists, so a slot that is freed twice is not
+ * put into its free list again.
+ *
+ * Returned capabilities are bounded to the requested size (rounded
+ * up to a representable length for large objects) and only have the
+ * RW permissions: no `VMEM`, so they can't be used to unmap memory,
+ * and no `EXECUTE`.
+ *
+ * All public functions take a single heap lock.
+ */
+
+#define ARENA_SIZE          (64ul << 20)
+#define MAX_ARENAS          16
+#define SLAB_PAGES          4
+#define MAX_SMALL           2048ul
+
+#define PAGE_FREE           0u
+#define PAGE_SLAB           (1u << 31)  // | class << 16 | page index in slab
+#define PAGE_RUN            (1u << 30)  // | number of pages (first page of a run)
+#define PAGE_RUN_BODY       (1u << 29)  // any other page of a run
+#define PAGE_FREE_RUN       (1u << 28)  // | number of pages (first and last page of a free run)
+
+#define USER_PERMS (PERM_GLOBAL | READ_CAP_PERMS | WRITE_CAP_PERMS)
+
+typedef struct {
+    char *root;         // owning capability for the whole arena
+    uint32_t *pagemap;  // one entry per page
+    uint8_t *freemap;   // one bit per granule: slot is free
+    size_t pages;       // total number of pages
+    size_t top;         // first page never used so far
+} arena_t;
+
+typedef struct run {
+    struct run *next;
+    struct run *prev;
+    size_t pages;
+} run_t;
+
+typedef struct slot {
+    struct slot *next;
+} slot_t;
+
+// Size classes: 4 classes per power of two, 16-byte granule.
+static const uint16_t class_size[] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048,
+};
+#define NUM_CLASSES (sizeof(class_size) / sizeof(class_size[0]))
+
+static struct {
+    size_t pgsz;
+    size_t narenas;
+    arena_t arenas[MAX_ARENAS];
+    slot_t *free_slots[NUM_CLASSES];
+    char *slab_next[NUM_CLASSES];   // bump pointer in the current slab
+    char *slab_end[NUM_CLASSES];
+    run_t *free_runs;
+    mutex_t lock;
+} heap;
+
+static size_t size_to_class(size_t size)
+{
+    if (size <= 128ul) {
+        return size ? (size - 1) / 16 : 0ul;
+    }
+    // 128 < size <= 2048: 4 classes per power of two
+    size_t s = size - 1;
+    size_t shift = 63 - __builtin_clzl(s); // s is in [2^shift, 2^(shift+1))
+    return 8 + (shift - 7) * 4 + (s >> (shift - 2)) - 4;
+}
+
+static arena_t *arena_create(size_t min_pages)
+{
+    if (heap.narenas == MAX_ARENAS) {
+        return NULL;
+    }
+    size_t pgsz = heap.pgsz;
+    size_t size = ARENA_SIZE;
+    size_t map_pages = 0;
+    for (;;) {
+        size_t pages = size / pgsz;
+        map_pages = (pages * (sizeof(uint32_t) + pgsz / 128) + pgsz - 1) / pgsz;
+        if (pages >= min_pages + map_pages) {
+            break;
+        }
+        size = (min_pages + map_pages + 1) * pgsz;
+    }
+    if (size / pgsz >= PAGE_FREE_RUN) {
+        return NULL; // free runs of the arena wouldn't fit into the page map
+    }
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    char *root = mmap(NULL, size, prot, flags, -1, 0);
+    if (!cheri_tag_get(root)) {
+        return NULL;
+    }
+    arena_t *a = &heap.arenas[heap.narenas++];
+    a->root = root;
+    a->pages = size / pgsz;
+    a->pagemap = (uint32_t *)cheri_bounds_set(root, a->pages * sizeof(uint32_t));
+    a->freemap = (uint8_t *)cheri_bounds_set(root + a->pages * sizeof(uint32_t), a->pages * heap.pgsz / 128);
+    a->top = map_pages;
+    for (size_t k = 0; k < map_pages; k++) {
+        a->pagemap[k] = PAGE_RUN_BODY;
+    }
+    return a;
+}
+
+/**
+ * Finds the arena that contains the given address.
+ */
+static arena_t *arena_find(size_t addr, size_t *page)
+{
+    for (size_t k = 0; k < heap.narenas; k++) {
+        arena_t *a = &heap.arenas[k];
+        size_t base = cheri_address_get(a->root);
+        if (base <= addr && addr < base + a->pages * heap.pgsz) {
+            *page = (addr - base) / heap.pgsz;
+            return a;
+        }
+    }
+    return NULL;
+}
+
+static void *arena_page(arena_t *a, size_t page)
+{
+    return a->root + page * heap.pgsz;
+}
+
+static void mark_run(arena_t *a, size_t page, size_t pages)
+{
+    a->pagemap[page] = PAGE_RUN | pages;
+    for (size_t k = 1; k < pages; k++) {
+        a->pagemap[page + k] = PAGE_RUN_BODY;
+    }
+}
+
+static void free_run_remove(run_t *r)
+{
+    if (r->prev) {
+        r->prev->next = r->next;
+    } else {
+        heap.free_runs = r->next;
+    }
+    if (r->next) {
+        r->next->prev = r->prev;
+    }
+}
+
+/**
+ * Returns a run of pages to the arena: merges it with neighbouring
+ * free runs and either lowers the top of the arena or puts the run
+ * into the list of free runs. Free runs are tagged in the page map
+ * on their first and last page.
+ */
+static void run_free(arena_t *a, size_t page, size_t pages)
+{
+    for (size_t k = 0; k < pages; k++) {
+        a->pagemap[page + k] = PAGE_FREE;
+    }
+    uint32_t prev = page ? a->pagemap[page - 1] : PAGE_FREE;
+    if (prev & PAGE_FREE_RUN) {
+        size_t n = prev & ~PAGE_FREE_RUN;
+        free_run_remove((run_t *)arena_page(a, page - n));
+        a->pagemap[page - 1] = PAGE_FREE;
+        page -= n;
+        pages += n;
+    }
+    uint32_t next = page + pages < a->top ? a->pagemap[page + pages] : PAGE_FREE;
+    if (next & PAGE_FREE_RUN) {
+        size_t n = next & ~PAGE_FREE_RUN;
+        free_run_remove((run_t *)arena_page(a, page + pages));
+        a->pagemap[page + pages] = PAGE_FREE;
+        pages += n;
+    }
+    if (page + pages == a->top) {
+        a->pagemap[page] = PAGE_FREE;
+        a->pagemap[page + pages - 1] = PAGE_FREE;
+        a->top = page; // give pages back to the top of the arena
+        return;
+    }
+    a->pagemap[page] = PAGE_FREE_RUN | pages;
+    a->pagemap[page + pages - 1] = PAGE_FREE_RUN | pages;
+    run_t *r = (run_t *)arena_page(a, page);
+    r->pages = pages;
+    r->prev = NULL;
+    r->next = heap.free_runs;
+    if (r->next) {
+        r->next->prev = r;
+    }
+    heap.free_runs = r;
+}
+
+/**
+ * Takes the first `pages` pages of the free run at `page` and
+ * returns the rest (if any) back to the list of free runs.
+ */
+static void run_split(arena_t *a, run_t *r, size_t page, size_t pages)
+{
+    size_t rest = r->pages - pages;
+    free_run_remove(r);
+    a->pagemap[page + pages + rest - 1] = PAGE_FREE;
+    mark_run(a, page, pages);
+    if (rest) {
+        run_free(a, page + pages, rest);
+    }
+}
+
+/**
+ * Allocates a run of pages whose start is aligned as required by
+ * `mask` (see `cheri_representable_alignment_mask`). On success the
+ * run is marked in the page map of its arena and a capability for the
+ * run derived from the arena root is returned.
+ */
+static char *run_allocate(size_t pages, size_t mask, arena_t **pa, size_t *ppage)
+{
+    // first fit from the free runs
+    for (run_t *r = heap.free_runs; r; r = r->next) {
+        if (r->pages < pages || (cheri_address_get(r) & ~mask)) {
+            continue;
+        }
+        size_t page;
+        arena_t *a = arena_find(cheri_address_get(r), &page);
+        run_split(a, r, page, pages);
+        *pa = a;
+        *ppage = page;
+        return arena_page(a, page);
+    }
+    // take fresh pages from the top of an arena
+    size_t narenas = heap.narenas;
+    for (size_t k = 0; k <= narenas; k++) {
+        arena_t *a = k < narenas ? &heap.arenas[k] : arena_create(pages + (~mask + 1) / heap.pgsz);
+        if (a == NULL) {
+            return NULL;
+        }
+        size_t page = a->top;
+        while (cheri_address_get(arena_page(a, page)) & ~mask) {
+            page++;
+        }
+        if (page + pages > a->pages) {
+            continue;
+        }
+        size_t skip = a->top;
+        a->top = page + pages;
+        mark_run(a, page, pages);
+        if (page > skip) {
+            run_free(a, skip, page - skip); // keep skipped pages for later use
+        }
+        *pa = a;
+        *ppage = page;
+        return arena_page(a, page);
+    }
+    return NULL;
+}
+
+/**
+ * Sets or clears the free bit of the slot at `slot`.
+ */
+static void slot_mark(const void *slot, bool free)
+{
+    size_t page;
+    arena_t *a = arena_find(cheri_address_get(slot), &page);
+    size_t g = (cheri_address_get(slot) - cheri_address_get(a->root)) / 16;
+    if (free) {
+        a->freemap[g / 8] |= 1u << (g % 8);
+    } else {
+        a->freemap[g / 8] &= ~(1u << (g % 8));
+    }
+}
+
+static bool slot_is_free(const arena_t *a, size_t addr)
+{
+    size_t g = (addr - cheri_address_get(a->root)) / 16;
+    return a->freemap[g / 8] & (1u << (g % 8));
+}
+
+static void *user_cap(void *cap, size_t size)
+{
+    return cheri_perms_and(cheri_bounds_set_exact(cap, size), USER_PERMS);
+}
+
+static void *malloc_small(size_t size)
+{
+    size_t cls = size_to_class(size);
+    size_t csz = class_size[cls];
+    slot_t *s = heap.free_slots[cls];
+    if (s != NULL) {
+        heap.free_slots[cls] = s->next;
+        slot_mark(s, false);
+        return user_cap(s, size);
+    }
+    if (heap.slab_next[cls] == NULL || heap.slab_next[cls] + csz > heap.slab_end[cls]) {
+        arena_t *a;
+        size_t page;
+        char *slab = run_allocate(SLAB_PAGES, ~0ul, &a, &page);
+        if (slab == NULL) {
+            return NULL;
+        }
+        for (size_t k = 0; k < SLAB_PAGES; k++) {
+            a->pagemap[page + k] = PAGE_SLAB | (cls << 16) | k;
+        }
+        heap.slab_next[cls] = slab;
+        heap.slab_end[cls] = slab + SLAB_PAGES * heap.pgsz;
+    }
+    char *p = heap.slab_next[cls];
+    heap.slab_next[cls] += csz;
+    return user_cap(p, size);
+}
+
+static void *malloc_large(size_t size)
+{
+    size_t len = cheri_representable_length(size);
+    size_t mask = cheri_representable_alignment_mask(size);
+    size_t pages = (len + heap.pgsz - 1) / heap.pgsz;
+    arena_t *a;
+    size_t page;
+    char *run = run_allocate(pages, mask, &a, &page);
+    if (run == NULL) {
+        return NULL;
+    }
+    return user_cap(run, len);
+}
+
+void *malloc(size_t size)
+{
+    if (size == 0ul) {
+        return NULL;
+    }
+    mutex_lock(&heap.lock);
+    if (heap.pgsz == 0ul) {
+        heap.pgsz = getpagesize();
+    }
+    void *p = NULL;
+    if (size <= MAX_SMALL) {
+        p = malloc_small(size);
+    } else if (size <= (PAGE_FREE_RUN - 1ul) * heap.pgsz) {
+        // larger runs don't fit into the page map
+        p = malloc_large(size);
+    }
+    mutex_unlock(&heap.lock);
+    return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(n, size, &total)) {
+        return NULL;
+    }
+    void *p = malloc(total);
+    if (p != NULL) {
+        memset(p, 0, total);
+    }
+    return p;
+}
+
+/**
+ * Describes the allocation a user capability points to. Returns
+ * false if `ptr` is not a capability returned by this allocator.
+ */
+typedef struct {
+    arena_t *arena;
+    size_t page;        // first page of the run (large) or the slab (small)
+    size_t cls;         // size class for small objects
+    size_t capacity;    // usable size of the slot or the run
+    char *block;        // slot or run capability derived from the root
+} block_info_t;
+
+static bool block_lookup(const void *ptr, block_info_t *info)
+{
+    if (!cheri_tag_get(ptr) || cheri_is_sealed(ptr)) {
+        return false;
+    }
+    size_t addr = cheri_address_get(ptr);
+    if (addr != cheri_base_get(ptr)) {
+        return false; // must point to the start of an allocation
+    }
+    size_t page;
+    arena_t *a = arena_find(addr, &page);
+    if (a == NULL) {
+        return false;
+    }
+    uint32_t e = a->pagemap[page];
+    size_t base = cheri_address_get(a->root);
+    if (e & PAGE_SLAB) {
+        size_t cls = (e >> 16) & 0xff;
+        size_t slab = page - (e & 0xffff);
+        size_t offset = addr - base - slab * heap.pgsz;
+        if (cls >= NUM_CLASSES || offset % class_size[cls]
+            || cheri_length_get(ptr) > class_size[cls] || slot_is_free(a, addr)) {
+            return false;
+        }
+        info->page = slab;
+        info->cls = cls;
+        info->capacity = class_size[cls];
+    } else if ((e & PAGE_RUN) && addr == base + page * heap.pgsz) {
+        info->page = page;
+        info->capacity = (e & ~PAGE_RUN) * heap.pgsz;
+    } else {
+        return false;
+    }
+    info->arena = a;
+    info->block = cheri_bounds_set_exact(cheri_address_set(a->root, addr), info->capacity);
+    return true;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    block_info_t info;
+    mutex_lock(&heap.lock);
+    if (!block_lookup(ptr, &info)) {
+        // not allocated here: ignore
+    } else if (info.capacity <= MAX_SMALL) {
+        slot_t *s = (slot_t *)info.block;
+        s->next = heap.free_slots[info.cls];
+        heap.free_slots[info.cls] = s;
+        slot_mark(s, true);
+    } else {
+        run_free(info.arena, info.page, info.capacity / heap.pgsz);
+    }
+    mutex_unlock(&heap.lock);
+}
+
+/**
+ * Tries to resize an allocation without moving it. Returns NULL if
+ * this is not possible and sets `*valid` if `ptr` is a valid block.
+ */
+static void *realloc_in_place(void *ptr, size_t size, bool *valid)
+{
+    block_info_t info;
+    if (!block_lookup(ptr, &info)) {
+        return NULL;
+    }
+    *valid = true;
+    if (info.capacity <= MAX_SMALL && size <= info.capacity) {
+        return user_cap(info.block, size);
+    }
+    size_t len = cheri_representable_length(size);
+    size_t mask = cheri_representable_alignment_mask(size);
+    if (info.capacity > MAX_SMALL && size > MAX_SMALL && !(cheri_address_get(info.block) & ~mask)) {
+        arena_t *a = info.arena;
+        size_t page = info.page;
+        size_t pages = info.capacity / heap.pgsz;
+        size_t need = (len + heap.pgsz - 1) / heap.pgsz;
+        uint32_t next = page + pages < a->top ? a->pagemap[page + pages] : PAGE_FREE;
+        if (need <= pages) {
+            mark_run(a, page, need);
+            if (need < pages) {
+                run_free(a, page + need, pages - need);
+            }
+            return user_cap(info.block, len);
+        } else if (page + pages == a->top && page + need <= a->pages) {
+            a->top = page + need;
+            mark_run(a, page, need);
+            return user_cap(arena_page(a, page), len);
+        } else if ((next & PAGE_FREE_RUN) && pages + (next & ~PAGE_FREE_RUN) >= need) {
+            run_split(a, (run_t *)arena_page(a, page + pages), page + pages, need - pages);
+            mark_run(a, page, need);
+            return user_cap(arena_page(a, page), len);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Resizes an allocation. The object is resized in place if the new
+ * size still fits into its slot or page run, or if the page run can
+ * be extended: it is at the top of its arena or followed by a free
+ * run that is large enough. Unused pages of a shrinking run are freed.
+ * Otherwise the contents are moved to a new allocation (capabilities
+ * stored in the object keep their tags as the alignment is preserved).
+ */
+void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0ul) {
+        free(ptr);
+        return NULL;
+    }
+    bool valid = false;
+    mutex_lock(&heap.lock);
+    void *p = realloc_in_place(ptr, size, &valid);
+    mutex_unlock(&heap.lock);
+    if (p != NULL || !valid) {
+        return p;
+    }
+    p = malloc(size);
+    if (p != NULL) {
+        size_t old = cheri_length_get(ptr);
+        memcpy(p, ptr, old < size ? old : size);
+        free(ptr);
+    }
+    return p;
+}
@@ -9,19 +9,156 @@
 
 typedef size_t (output_fun_t)(void *h, const void *buf, size_t count);
 
-static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args);
+static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args, const uint64_t *tags);
+static int print_core(output_fun_t *fn, void *h, const print_arg_t *args, size_t count);
 
-static size_t stdout_output(__attribute__((unused)) void *unused, const void *buf, size_t count)
+/**
+ * Output stream. Data is accumulated in a bounded buffer and is
+ * written out either when the buffer cannot take more data or, in
+ * line buffered mode, when a new line character has been added.
+ * When the buffer overflows, the buffered data and the new chunk
+ * are written out together using one `writev` system call.
+ * The stream is locked for the duration of each call, so output of
+ * one `printf` is never interleaved with output from another thread.
+ */
+struct stream {
+    int fd;
+    int mode;       // one of _IOFBF, _IOLBF, _IONBF
+    char *own;      // stream's own buffer
+    char *buf;      // buffer in use
+    size_t size;    // size of the buffer in use
+    size_t pos;     // number of buffered bytes
+    mutex_t lock;
+};
+
+static char stdout_buf[BUFSIZ];
+static FILE __stdout = { .fd = 1, .mode = _IOLBF, .own = stdout_buf, .buf = stdout_buf, .size = BUFSIZ, .pos = 0, .lock = MUTEX_INITIALIZER };
+FILE *const stdout = &__stdout;
+
+/**
+ * Writes out all the data described by `iov` retrying after
+ * partial writes. Returns false if the data could not be written.
+ */
+static bool write_all(int fd, iovec_t *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t r = writev(fd, iov, iovcnt);
+        if (r <= 0) {
+            return false;
+        }
+        size_t k = r;
+        for (; iovcnt > 0 && k >= iov->iov_len; iov++, iovcnt--) {
+            k -= iov->iov_len;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base += k;
+            iov->iov_len -= k;
+        }
+    }
+    return true;
+}
+
+/**
+ * Flushes buffered data together with optional extra `count` bytes
+ * from `buf` (which are not copied into the stream's buffer).
+ */
+static bool stream_flush(FILE *s, const void *buf, size_t count)
+{
+    iovec_t iov[2];
+    int n = 0;
+    if (s->pos) {
+        iov[n].iov_base = s->buf;
+        iov[n].iov_len = s->pos;
+        n++;
+    }
+    if (count) {
+        iov[n].iov_base = (void *)buf;
+        iov[n].iov_len = count;
+        n++;
+    }
+    s->pos = 0;
+    return write_all(s->fd, iov, n);
+}
+
+static size_t stream_output(void *h, const void *buf, size_t count)
+{
+    FILE *s = (FILE *)h;
+    size_t tail = cheri_get_tail(buf);
+    if (count > tail) {
+        count = tail;
+    }
+    if (count == 0ul) {
+        return 0ul;
+    }
+    if (s->mode == _IONBF) {
+        return write(s->fd, buf, count);
+    }
+    if (s->pos + count > s->size) {
+        return stream_flush(s, buf, count) ? count : 0ul;
+    }
+    memcpy(s->buf + s->pos, buf, count);
+    s->pos += count;
+    if (s->mode == _IOLBF && memchr(buf, '\n', count)) {
+        stream_flush(s, NULL, 0ul);
+    }
+    return count;
+}
+
+/**
+ * Writes out buffered data. If `stream` is NULL, all
+ * streams are flushed.
+ */
+int fflush(FILE *stream)
+{
+    if (stream == NULL) {
+        stream = stdout;
+    }
+    if (!cheri_is_deref(stream)) {
+        return -1;
+    }
+    mutex_lock(&stream->lock);
+    bool ok = stream_flush(stream, NULL, 0ul);
+    mutex_unlock(&stream->lock);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Changes buffering mode for a stream. If `buf` is NULL, the
+ * stream uses its own buffer. Otherwise at most `size`
+ * bytes of `buf` will be used (less if the capability is shorter).
+ * Any data buffered so far is flushed first.
+ */
+int setvbuf(FILE *stream, char *buf, int mode, size_t size)
 {
-    const int fd = 1; // stdout
-    return write(fd, buf, count);
+    if (!cheri_is_deref(stream) || mode < _IOFBF || mode > _IONBF) {
+        return -1;
+    }
+    if (buf == NULL) {
+        buf = stream->own;
+        size = cheri_get_tail(buf);
+    } else if (!cheri_is_deref(buf) || size == 0ul) {
+        return -1;
+    } else if (size > cheri_get_tail(buf)) {
+        size = cheri_get_tail(buf);
+    }
+    mutex_lock(&stream->lock);
+    bool ok = stream_flush(stream, NULL, 0ul);
+    if (ok) {
+        stream->buf = buf;
+        stream->size = size;
+        stream->mode = mode;
+    }
+    mutex_unlock(&stream->lock);
+    return ok ? 0 : -1;
 }
 
 int printf(const char *fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    int r = printf_core(stdout_output, NULL, fmt, args);
+    mutex_lock(&stdout->lock);
+    int r = printf_core(stream_output, stdout, fmt, args, NULL);
+    mutex_unlock(&stdout->lock);
     va_end(args);
     return r;
 }
@@ -31,17 +168,44 @@ typedef struct {
     const char *lim;
 } output_buf_t;
 
+/**
+ * Output for sprintf: copies as much as fits before `lim`.
+ */
 static size_t buffer_output(void *h, const void *buf, size_t count)
 {
-    char *src = (char *)buf;
-    const char *lim = (char *)cheri_get_limit(buf);
     output_buf_t *ph = (output_buf_t *)h;
-    size_t k = 0;
-    for(; src < lim && count && ph->dst < ph->lim; src++, ph->dst++, count--) {
-        *(ph->dst) = *src;
-        k++;
+    size_t tail = cheri_get_tail(buf);
+    size_t room = ph->lim - ph->dst;
+    if (count > tail) {
+        count = tail;
+    }
+    if (count > room) {
+        count = room;
     }
-    return k;
+    memcpy(ph->dst, buf, count);
+    ph->dst += count;
+    return count;
+}
+
+/**
+ * Output for snprintf: copies as much as fits before `lim`, the rest
+ * is dropped but still counted, so that the result is the length of
+ * the complete output. With no buffer nothing is copied at all.
+ */
+static size_t bounded_output(void *h, const void *buf, size_t count)
+{
+    output_buf_t *ph = (output_buf_t *)h;
+    size_t tail = cheri_get_tail(buf);
+    if (count > tail) {
+        count = tail;
+    }
+    size_t room = ph->lim - ph->dst;
+    size_t n = count < room ? count : room;
+    if (n) {
+        memcpy(ph->dst, buf, n);
+        ph->dst += n;
+    }
+    return count;
 }
 
 int sprintf(char *dst, const char *fmt, ...)
@@ -49,7 +213,7 @@ int sprintf(char *dst, const char *fmt, ...)
     output_buf_t h = { .dst = dst, .lim = (char *)cheri_get_limit(dst) };
     va_list args;
     va_start(args, fmt);
-    int r = printf_core(buffer_output, &h, fmt, args);
+    int r = printf_core(buffer_output, &h, fmt, args, NULL);
     va_end(args);
     if (h.dst == h.lim) {
         r--;
@@ -60,6 +224,84 @@ int sprintf(char *dst, const char *fmt, ...)
     return r;
 }
 
+static int bounded_printf(char *dst, size_t size, const char *fmt, va_list args, const uint64_t *tags)
+{
+    output_buf_t h = { .dst = NULL, .lim = NULL };
+    size_t tail = cheri_get_tail(dst);
+    if (size > tail) {
+        size = tail;
+    }
+    if (size > 0ul) {
+        h.dst = dst;
+        h.lim = dst + size - 1;
+    }
+    int r = printf_core(bounded_output, &h, fmt, args, tags);
+    if (h.dst != NULL) {
+        *(h.dst) = '\0';
+    }
+    return r;
+}
+
+/**
+ * Formats at most `size - 1` characters into `dst` followed by a NUL
+ * (`size` is clamped to the bounds of `dst`). Returns the length the
+ * complete output would have, so `vsnprintf(NULL, 0, ...)` can be used
+ * to find the size of the buffer needed.
+ */
+int vsnprintf(char *dst, size_t size, const char *fmt, va_list args)
+{
+    return bounded_printf(dst, size, fmt, args, NULL);
+}
+
+/**
+ * Same as `vsnprintf`, but the tags of capability arguments printed
+ * with `%#p` and `%+#p` are taken from `tags` (bit k for argument k)
+ * rather than from the arguments. This is used to format capabilities
+ * recorded by the binary logger, which lose their tags when they are
+ * written to a file.
+ */
+int vsnprintf_tags(char *dst, size_t size, const char *fmt, va_list args, uint64_t tags)
+{
+    return bounded_printf(dst, size, fmt, args, &tags);
+}
+
+int snprintf(char *dst, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int r = vsnprintf(dst, size, fmt, args);
+    va_end(args);
+    return r;
+}
+
+/**
+ * Prints arguments prepared by the `print` macro to stdout.
+ */
+int print_args(const print_arg_t *args, size_t count)
+{
+    mutex_lock(&stdout->lock);
+    int r = print_core(stream_output, stdout, args, count);
+    mutex_unlock(&stdout->lock);
+    return r;
+}
+
+/**
+ * Formats arguments prepared by the `sprint` macro into `dst` with the
+ * same truncation rules as `sprintf`.
+ */
+int sprint_args(char *dst, const print_arg_t *args, size_t count)
+{
+    output_buf_t h = { .dst = dst, .lim = (char *)cheri_get_limit(dst) };
+    int r = print_core(buffer_output, &h, args, count);
+    if (h.dst == h.lim) {
+        r--;
+        *(--h.dst) = '\0';
+    } else {
+        *(h.dst) = '\0';
+    }
+    return r;
+}
+
 #define TEST(x, f) (((x) & (f)) == (f))
 
 typedef enum { IDLE, FORMAT, RESET } fmt_phase_t;
@@ -72,20 +314,31 @@ typedef enum {
     SIGN_PLUS = 16,
     HEX = 32,
     ALTERNATE = 64,
+    PRECISION = 128,
+    SHORTEST = 256,
 } fmt_feat_t;
 typedef struct {
     fmt_phase_t phase;
     fmt_feat_t feat;
     size_t width;
+    size_t precision;
 } fmt_state_t;
 
 static const char hex_digits[16] = "0123456789abcdef";
-static const char dec_digits[10] = "0123456789";
+static const char hex_digits_upper[16] = "0123456789ABCDEF";
+static const char dec_pairs[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char pad_spaces[32] = "                                ";
+static const char pad_zeros[32] = "00000000000000000000000000000000";
 
 /**
- * Convert unsigned integer to string using given `base` and `digits`.
- * Optional `prefix` can be used to support negative numbers and other
- * prefixes.
+ * Convert unsigned integer to decimal string, two digits at a time.
+ * Optional `sign` character is prepended unless it is zero.
  *
  * The output buffer is provided via `end` and must point to the end of
  * the buffer (digits are printed backwards).
@@ -94,31 +347,735 @@ static const char dec_digits[10] = "0123456789";
  * of the integer without null-terminator. Bounds are set to cover
  * only the printable characters.
  */
-static char *uint_to_str(char *end, uint64_t val, const char *digits, size_t base, const char *prefix)
+static char *dec_to_str(char *end, uint64_t val, char sign)
+{
+    char *buf = end;
+    for (; val >= 100ul; val /= 100ul) {
+        const char *d = dec_pairs + 2 * (val % 100ul);
+        --buf; *buf = d[1];
+        --buf; *buf = d[0];
+    }
+    if (val >= 10ul) {
+        --buf; *buf = dec_pairs[2 * val + 1];
+        --buf; *buf = dec_pairs[2 * val];
+    } else {
+        --buf; *buf = '0' + val;
+    }
+    if (sign) {
+        --buf; *buf = sign;
+    }
+    return cheri_bounds_set_exact(buf, end - buf);
+}
+
+/**
+ * Convert unsigned integer to hexadecimal string, optionally with
+ * the `0x` prefix. Same conventions as for `dec_to_str` apply.
+ */
+static char *hex_to_str(char *end, uint64_t val, bool prefix)
 {
     char *buf = end;
-    if (val == 0ul) {
+    do {
+        --buf; *buf = hex_digits[val & 0xful];
+        val >>= 4;
+    } while (val);
+    if (prefix) {
+        --buf; *buf = 'x';
         --buf; *buf = '0';
+    }
+    return cheri_bounds_set_exact(buf, end - buf);
+}
+
+/**
+ * Print 64-bit value as 16 hex digits with leading zeros.
+ * Returns pointer to the next character after the digits.
+ */
+static char *hex64_to_str(char *dst, uint64_t val)
+{
+    for (size_t k = 16; k > 0; k--) {
+        dst[k - 1] = hex_digits[val & 0xful];
+        val >>= 4;
+    }
+    return dst + 16;
+}
+
+/**
+ * Outputs `count` padding characters (spaces or zeros) in chunks
+ * taken from a constant block.
+ */
+static size_t output_padding(output_fun_t *fn, void *h, bool zero, size_t count)
+{
+    const char *fill = zero ? pad_zeros : pad_spaces;
+    size_t n = 0;
+    while (count > 0) {
+        size_t k = count < sizeof(pad_spaces) ? count : sizeof(pad_spaces);
+        size_t w = fn(h, fill, k);
+        n += w;
+        if (w < k) {
+            break; // output is full
+        }
+        count -= k;
+    }
+    return n;
+}
+
+/**
+ * A piece of formatted output: `len` characters from `str` or `len`
+ * zeros if `str` is NULL.
+ */
+typedef struct {
+    const char *str;
+    size_t len;
+} piece_t;
+
+/**
+ * Outputs a field made of `count` pieces padded up to `width` characters
+ * according to the `LEFT_ALIGN` and `ZERO_PAD` flags. The first piece
+ * is the prefix (sign or `0x`): zero padding is inserted after it.
+ */
+static size_t output_pieces(output_fun_t *fn, void *h, const piece_t *pc, size_t count, size_t width, fmt_feat_t feat)
+{
+    size_t len = 0;
+    for (size_t k = 0; k < count; k++) {
+        len += pc[k].len;
+    }
+    size_t pad = len < width ? width - len : 0ul;
+    bool left = TEST(feat, LEFT_ALIGN);
+    bool zero = !left && TEST(feat, ZERO_PAD);
+    size_t n = 0;
+    if (!left && !zero) {
+        n += output_padding(fn, h, false, pad);
+    }
+    for (size_t k = 0; k < count; k++) {
+        if (pc[k].str == NULL) {
+            n += output_padding(fn, h, true, pc[k].len);
+        } else if (pc[k].len) {
+            n += fn(h, pc[k].str, pc[k].len);
+        }
+        if (k == 0 && zero) {
+            n += output_padding(fn, h, true, pad);
+        }
+    }
+    if (left) {
+        n += output_padding(fn, h, false, pad);
+    }
+    return n;
+}
+
+/**
+ * Outputs `len` characters from `str` padded up to `width` characters.
+ * Zeros are inserted after the first `prefix` characters.
+ */
+static size_t output_field(output_fun_t *fn, void *h, const char *str, size_t len,
+    size_t prefix, size_t width, fmt_feat_t feat)
+{
+    piece_t pc[2] = { { str, prefix }, { str + prefix, len - prefix } };
+    return output_pieces(fn, h, pc, 2, width, feat);
+}
+
+/**
+ * Outputs integer converted to string `t` (see `dec_to_str`) whose first
+ * `prefix` characters are the sign or `0x`. Precision is the minimum
+ * number of digits, and zero value with zero precision prints no digits.
+ */
+static size_t output_int(output_fun_t *fn, void *h, const char *t, size_t prefix, bool zero_value, const fmt_state_t *state)
+{
+    fmt_feat_t feat = state->feat;
+    size_t digits = cheri_length_get(t) - prefix;
+    size_t zeros = 0;
+    if (TEST(feat, PRECISION)) {
+        feat &= ~ZERO_PAD;
+        if (zero_value && state->precision == 0ul) {
+            digits = 0;
+        }
+        zeros = state->precision > digits ? state->precision - digits : 0ul;
+    }
+    piece_t pc[3] = { { t, prefix }, { NULL, zeros }, { t + prefix, digits } };
+    return output_pieces(fn, h, pc, 3, state->width, feat);
+}
+
+/*
+ * Floating-point conversions.
+ *
+ * Decimal digits are generated by the Grisu2 algorithm (F. Loitsch,
+ * "Printing Floating-Point Numbers Quickly and Accurately with Integers",
+ * PLDI 2010) which finds a string of digits that reads back as the same
+ * double. It is the shortest such string in all but rare cases (when the
+ * shortest candidate lies at the very edge of the rounding interval, one
+ * more digit is printed). It only needs 64-bit integer arithmetic and a
+ * table of cached powers of ten.
+ *
+ * If precision asks for fewer digits, these are rounded. Ties in the
+ * shortest representation are resolved by comparing it with the exact
+ * binary value using a small fixed-size big integer. If precision asks
+ * for more digits, the rest are zeros as long as there are at most 15
+ * significant digits and the value is normal (then rounding the exact
+ * value gives the same result). Otherwise all digits of the exact
+ * binary value are generated with the big integer and rounded, like
+ * glibc does.
+ */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} diyfp_t;
+
+typedef union {
+    double d;
+    uint64_t u;
+} fp_bits_t;
+
+#define FP_FRAC_MASK ((1ul << 52) - 1)
+#define FP_EXP(u) ((int)((u) >> 52) & 0x7ff)
+
+// Normalised 64-bit approximations of 10^-348, 10^-340, ..., 10^340
+static const diyfp_t cached_powers[87] = {
+    { 0xfa8fd5a0081c0288ul, -1220 }, { 0xbaaee17fa23ebf76ul, -1193 }, { 0x8b16fb203055ac76ul, -1166 },
+    { 0xcf42894a5dce35eaul, -1140 }, { 0x9a6bb0aa55653b2dul, -1113 }, { 0xe61acf033d1a45dful, -1087 },
+    { 0xab70fe17c79ac6caul, -1060 }, { 0xff77b1fcbebcdc4ful, -1034 }, { 0xbe5691ef416bd60cul, -1007 },
+    { 0x8dd01fad907ffc3cul, -980 }, { 0xd3515c2831559a83ul, -954 }, { 0x9d71ac8fada6c9b5ul, -927 },
+    { 0xea9c227723ee8bcbul, -901 }, { 0xaecc49914078536dul, -874 }, { 0x823c12795db6ce57ul, -847 },
+    { 0xc21094364dfb5637ul, -821 }, { 0x9096ea6f3848984ful, -794 }, { 0xd77485cb25823ac7ul, -768 },
+    { 0xa086cfcd97bf97f4ul, -741 }, { 0xef340a98172aace5ul, -715 }, { 0xb23867fb2a35b28eul, -688 },
+    { 0x84c8d4dfd2c63f3bul, -661 }, { 0xc5dd44271ad3cdbaul, -635 }, { 0x936b9fcebb25c996ul, -608 },
+    { 0xdbac6c247d62a584ul, -582 }, { 0xa3ab66580d5fdaf6ul, -555 }, { 0xf3e2f893dec3f126ul, -529 },
+    { 0xb5b5ada8aaff80b8ul, -502 }, { 0x87625f056c7c4a8bul, -475 }, { 0xc9bcff6034c13053ul, -449 },
+    { 0x964e858c91ba2655ul, -422 }, { 0xdff9772470297ebdul, -396 }, { 0xa6dfbd9fb8e5b88ful, -369 },
+    { 0xf8a95fcf88747d94ul, -343 }, { 0xb94470938fa89bcful, -316 }, { 0x8a08f0f8bf0f156bul, -289 },
+    { 0xcdb02555653131b6ul, -263 }, { 0x993fe2c6d07b7facul, -236 }, { 0xe45c10c42a2b3b06ul, -210 },
+    { 0xaa242499697392d3ul, -183 }, { 0xfd87b5f28300ca0eul, -157 }, { 0xbce5086492111aebul, -130 },
+    { 0x8cbccc096f5088ccul, -103 }, { 0xd1b71758e219652cul, -77 }, { 0x9c40000000000000ul, -50 },
+    { 0xe8d4a51000000000ul, -24 }, { 0xad78ebc5ac620000ul, 3 }, { 0x813f3978f8940984ul, 30 },
+    { 0xc097ce7bc90715b3ul, 56 }, { 0x8f7e32ce7bea5c70ul, 83 }, { 0xd5d238a4abe98068ul, 109 },
+    { 0x9f4f2726179a2245ul, 136 }, { 0xed63a231d4c4fb27ul, 162 }, { 0xb0de65388cc8ada8ul, 189 },
+    { 0x83c7088e1aab65dbul, 216 }, { 0xc45d1df942711d9aul, 242 }, { 0x924d692ca61be758ul, 269 },
+    { 0xda01ee641a708deaul, 295 }, { 0xa26da3999aef774aul, 322 }, { 0xf209787bb47d6b85ul, 348 },
+    { 0xb454e4a179dd1877ul, 375 }, { 0x865b86925b9bc5c2ul, 402 }, { 0xc83553c5c8965d3dul, 428 },
+    { 0x952ab45cfa97a0b3ul, 455 }, { 0xde469fbd99a05fe3ul, 481 }, { 0xa59bc234db398c25ul, 508 },
+    { 0xf6c69a72a3989f5cul, 534 }, { 0xb7dcbf5354e9beceul, 561 }, { 0x88fcf317f22241e2ul, 588 },
+    { 0xcc20ce9bd35c78a5ul, 614 }, { 0x98165af37b2153dful, 641 }, { 0xe2a0b5dc971f303aul, 667 },
+    { 0xa8d9d1535ce3b396ul, 694 }, { 0xfb9b7cd9a4a7443cul, 720 }, { 0xbb764c4ca7a44410ul, 747 },
+    { 0x8bab8eefb6409c1aul, 774 }, { 0xd01fef10a657842cul, 800 }, { 0x9b10a4e5e9913129ul, 827 },
+    { 0xe7109bfba19c0c9dul, 853 }, { 0xac2820d9623bf429ul, 880 }, { 0x80444b5e7aa7cf85ul, 907 },
+    { 0xbf21e44003acdd2dul, 933 }, { 0x8e679c2f5e44ff8ful, 960 }, { 0xd433179d9c8cb841ul, 986 },
+    { 0x9e19db92b4e31ba9ul, 1013 }, { 0xeb96bf6ebadf77d9ul, 1039 }, { 0xaf87023b9bf0ee6bul, 1066 },
+};
+
+static const uint64_t pow10_u64[20] = {
+    1ul, 10ul, 100ul, 1000ul, 10000ul, 100000ul, 1000000ul, 10000000ul,
+    100000000ul, 1000000000ul, 10000000000ul, 100000000000ul,
+    1000000000000ul, 10000000000000ul, 100000000000000ul,
+    1000000000000000ul, 10000000000000000ul, 100000000000000000ul,
+    1000000000000000000ul, 10000000000000000000ul,
+};
+
+static diyfp_t diyfp_mul(diyfp_t x, diyfp_t y)
+{
+    unsigned __int128 p = (unsigned __int128)x.f * y.f;
+    uint64_t hi = (uint64_t)(p >> 64);
+    uint64_t lo = (uint64_t)p;
+    return (diyfp_t){ hi + (lo >> 63), x.e + y.e + 64 };
+}
+
+static diyfp_t diyfp_normalize(diyfp_t x)
+{
+    int s = __builtin_clzl(x.f);
+    return (diyfp_t){ x.f << s, x.e - s };
+}
+
+/**
+ * Moves the last digit closer to the exact value while the result
+ * stays within the rounding interval.
+ */
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa
+        && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int grisu_digits(diyfp_t w, diyfp_t mp, uint64_t delta, char *buf, int *k10)
+{
+    diyfp_t one = { 1ul << -mp.e, mp.e };
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = 1;
+    while (kappa < 10 && p1 >= pow10_u64[kappa]) {
+        kappa++;
+    }
+    int len = 0;
+    while (kappa > 0) {
+        uint32_t d = p1 / pow10_u64[kappa - 1];
+        p1 %= pow10_u64[kappa - 1];
+        if (d || len) {
+            buf[len++] = '0' + d;
+        }
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *k10 += kappa;
+            grisu_round(buf, len, delta, rest, pow10_u64[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        uint32_t d = (uint32_t)(p2 >> -one.e);
+        if (d || len) {
+            buf[len++] = '0' + d;
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k10 += kappa;
+            grisu_round(buf, len, delta, p2, one.f, wp_w * (-kappa < 20 ? pow10_u64[-kappa] : 0ul));
+            return len;
+        }
+    }
+}
+
+/**
+ * Writes shortest decimal digits of positive finite value `u` (bits
+ * of a double) into `buf` (at least 18 chars) and returns their count.
+ * The first digit is at 10^`exp10`.
+ */
+static int grisu2(uint64_t u, char *buf, int *exp10)
+{
+    uint64_t frac = u & FP_FRAC_MASK;
+    int bexp = FP_EXP(u);
+    diyfp_t v = bexp ? (diyfp_t){ frac | (1ul << 52), bexp - 1075 } : (diyfp_t){ frac, -1074 };
+
+    // boundaries of the interval of values that round to `v`
+    diyfp_t mp = diyfp_normalize((diyfp_t){ (v.f << 1) + 1, v.e - 1 });
+    diyfp_t mm = v.f == (1ul << 52)
+        ? (diyfp_t){ (v.f << 2) - 1, v.e - 2 }
+        : (diyfp_t){ (v.f << 1) - 1, v.e - 1 };
+    mm.f <<= mm.e - mp.e;
+    mm.e = mp.e;
+
+    // cached power of ten that brings the binary exponent to [-60, -32]
+    double dk = (-61 - mp.e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if (dk - k > 0.0) {
+        k++;
+    }
+    size_t index = (size_t)(k >> 3) + 1;
+    int k10 = 348 - (int)(index << 3);
+    diyfp_t c = cached_powers[index];
+
+    diyfp_t w = diyfp_mul(diyfp_normalize(v), c);
+    diyfp_t wp = diyfp_mul(mp, c);
+    diyfp_t wm = diyfp_mul(mm, c);
+    wm.f++;
+    wp.f--;
+    int len = grisu_digits(w, wp, wp.f - wm.f, buf, &k10);
+    while (len > 1 && buf[len - 1] == '0') {
+        len--;
+        k10++;
+    }
+    *exp10 = len + k10 - 1;
+    return len;
+}
+
+// Unsigned big integer large enough for m * 5^1074 (2547 bits)
+#define BIG_WORDS 80
+
+// Significant digits of a double that can be padded with zeros
+#define FP_SHORTEST_EXACT 15
+
+// All digits of m * 5^1074 (767), in chunks of 9
+#define FP_EXACT_DIGITS 774
+
+typedef struct {
+    uint32_t w[BIG_WORDS];
+    size_t n;
+} big_t;
+
+static void big_init(big_t *b, uint64_t v)
+{
+    b->w[0] = (uint32_t)v;
+    b->w[1] = (uint32_t)(v >> 32);
+    b->n = b->w[1] ? 2 : 1;
+}
+
+static void big_mul(big_t *b, uint32_t m)
+{
+    uint64_t carry = 0;
+    for (size_t k = 0; k < b->n; k++) {
+        uint64_t t = (uint64_t)b->w[k] * m + carry;
+        b->w[k] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    if (carry && b->n < BIG_WORDS) {
+        b->w[b->n++] = (uint32_t)carry;
+    }
+}
+
+static void big_mul_pow5(big_t *b, int e)
+{
+    for (; e >= 13; e -= 13) {
+        big_mul(b, 1220703125u); // 5^13
+    }
+    uint32_t m = 1;
+    for (; e > 0; e--) {
+        m *= 5;
+    }
+    big_mul(b, m);
+}
+
+static void big_shl(big_t *b, int e)
+{
+    size_t words = e / 32;
+    size_t bits = e % 32;
+    size_t n = b->n;
+    if (n + words + 1 > BIG_WORDS) {
+        return; // doesn't happen for doubles
+    }
+    uint32_t *w = b->w;
+    uint32_t top = bits ? w[n - 1] >> (32 - bits) : 0u;
+    for (size_t k = n; k-- > 0;) {
+        uint32_t lo = k > 0 && bits ? w[k - 1] >> (32 - bits) : 0u;
+        w[k + words] = (w[k] << bits) | lo;
+    }
+    for (size_t k = 0; k < words; k++) {
+        w[k] = 0;
+    }
+    b->n = n + words;
+    if (top) {
+        w[b->n++] = top;
+    }
+}
+
+/**
+ * Divides `b` by `d` and returns the remainder.
+ */
+static uint32_t big_div(big_t *b, uint32_t d)
+{
+    uint64_t rem = 0;
+    for (size_t k = b->n; k-- > 0;) {
+        uint64_t t = (rem << 32) | b->w[k];
+        b->w[k] = (uint32_t)(t / d);
+        rem = t % d;
+    }
+    while (b->n > 1 && b->w[b->n - 1] == 0) {
+        b->n--;
+    }
+    return (uint32_t)rem;
+}
+
+static int big_cmp(const big_t *a, const big_t *b)
+{
+    if (a->n != b->n) {
+        return a->n < b->n ? -1 : 1;
+    }
+    for (size_t k = a->n; k-- > 0;) {
+        if (a->w[k] != b->w[k]) {
+            return a->w[k] < b->w[k] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compares positive value `u` (bits of a double) with `dec` * 10^`exp10`.
+ */
+static int fp_cmp_exact(uint64_t u, uint64_t dec, int exp10)
+{
+    uint64_t m = u & FP_FRAC_MASK;
+    int bexp = FP_EXP(u);
+    int e2 = bexp ? bexp - 1075 : -1074;
+    if (bexp) {
+        m |= 1ul << 52;
+    }
+    // m * 2^e2 vs dec * 2^exp10 * 5^exp10 scaled to integers
+    int s2 = -e2 > -exp10 ? -e2 : -exp10;
+    s2 = s2 > 0 ? s2 : 0;
+    int s5 = exp10 < 0 ? -exp10 : 0;
+    big_t lhs, rhs;
+    big_init(&lhs, m);
+    big_mul_pow5(&lhs, s5);
+    big_shl(&lhs, e2 + s2);
+    big_init(&rhs, dec);
+    big_mul_pow5(&rhs, exp10 + s5);
+    big_shl(&rhs, exp10 + s2);
+    return big_cmp(&lhs, &rhs);
+}
+
+/**
+ * Writes all decimal digits of positive finite value `u` (bits of a
+ * double) into `buf` (FP_EXACT_DIGITS chars) and returns their count
+ * without trailing zeros. The first digit is at 10^`exp10`.
+ */
+static int fp_exact(uint64_t u, char *buf, int *exp10)
+{
+    uint64_t m = u & FP_FRAC_MASK;
+    int bexp = FP_EXP(u);
+    int e2 = bexp ? bexp - 1075 : -1074;
+    if (bexp) {
+        m |= 1ul << 52;
+    }
+    // m * 2^e2 = m * 5^-e2 * 10^e2 for negative e2
+    big_t b;
+    big_init(&b, m);
+    int scale = 0;
+    if (e2 >= 0) {
+        big_shl(&b, e2);
     } else {
-        for(size_t rem; val > 0ul; val /= base)
-        {
-            rem = val % base;
-            --buf; *buf = digits[rem];
+        big_mul_pow5(&b, -e2);
+        scale = -e2;
+    }
+    char *end = buf + FP_EXACT_DIGITS, *d = end;
+    while (b.n > 1 || b.w[0]) {
+        uint32_t r = big_div(&b, 1000000000u);
+        for (int k = 0; k < 9; k++) {
+            *(--d) = '0' + r % 10;
+            r /= 10;
         }
     }
-    if (prefix) {
-        if (*prefix == 'x') {
-            --buf; *buf = 'x';
-            --buf; *buf = '0';
+    while (*d == '0') {
+        d++;
+    }
+    int len = end - d;
+    *exp10 = len - 1 - scale;
+    memmove(buf, d, len);
+    while (len > 1 && buf[len - 1] == '0') {
+        len--;
+    }
+    return len;
+}
+
+/**
+ * Rounds `len` digits of value `u` to `ndigits` significant digits
+ * (half to even for exact ties). The digits are either the shortest
+ * ones (see `grisu2`) or, if `exact` is set, all digits of the value
+ * (see `fp_exact`). Returns the new number of digits without trailing
+ * zeros, 0 if the value rounds to 0.
+ */
+static int fp_round(uint64_t u, char *buf, int len, int *exp10, int ndigits, bool exact)
+{
+    if (ndigits >= len) {
+        return len;
+    } else if (ndigits < 0) {
+        return 0;
+    }
+    bool up;
+    if (buf[ndigits] != '5' || ndigits + 1 < len) {
+        up = buf[ndigits] >= '5';
+    } else {
+        uint64_t dec = 0;
+        for (int k = 0; !exact && k < len; k++) {
+            dec = 10 * dec + (buf[k] - '0');
+        }
+        int c = exact ? 0 : fp_cmp_exact(u, dec, *exp10 - len + 1);
+        up = c > 0 || (c == 0 && ndigits > 0 && ((buf[ndigits - 1] - '0') & 1));
+    }
+    len = ndigits;
+    if (up) {
+        int k = len - 1;
+        while (k >= 0 && buf[k] == '9') {
+            k--;
+        }
+        if (k < 0) {
+            buf[0] = '1';
+            len = 1;
+            (*exp10)++;
         } else {
-            --buf; *buf = *prefix;
+            buf[k]++;
+            len = k + 1;
         }
     }
-    return cheri_bounds_set_exact(buf, end - buf);
+    while (len > 0 && buf[len - 1] == '0') {
+        len--;
+    }
+    return len;
+}
+
+/**
+ * Outputs `%a`: exact hexadecimal representation of a double.
+ */
+static size_t output_hexfp(output_fun_t *fn, void *h, uint64_t u, piece_t *pc, const fmt_state_t *state, bool upper)
+{
+    const char *digits = upper ? hex_digits_upper : hex_digits;
+    uint64_t frac = u & FP_FRAC_MASK;
+    int bexp = FP_EXP(u);
+    int lead = bexp ? 1 : 0;
+    int e = bexp ? bexp - 1023 : frac ? -1022 : 0;
+    size_t nd = 13;
+    size_t zeros = 0;
+    if (TEST(state->feat, PRECISION) && state->precision < nd) {
+        size_t shift = 4 * (nd - state->precision);
+        uint64_t rem = frac & ((1ul << shift) - 1);
+        uint64_t half = 1ul << (shift - 1);
+        nd = state->precision;
+        frac >>= shift;
+        uint64_t odd = nd ? frac & 1ul : (uint64_t)lead;
+        if (rem > half || (rem == half && odd)) {
+            frac++;
+        }
+        if (frac >> (4 * nd)) {
+            lead++;
+            frac = 0;
+        }
+    } else if (TEST(state->feat, PRECISION)) {
+        zeros = state->precision - nd;
+    } else {
+        for (; nd > 0 && !(frac & 0xful); nd--) {
+            frac >>= 4;
+        }
+    }
+    char lbuf[2] = { '0' + lead, '.' };
+    char dbuf[13];
+    for (size_t k = nd; k > 0; k--) {
+        dbuf[k - 1] = digits[frac & 0xful];
+        frac >>= 4;
+    }
+    char ebuf[4], *eend = ebuf + sizeof(ebuf);
+    char pbuf[2] = { upper ? 'P' : 'p', e < 0 ? '-' : '+' };
+    char *es = dec_to_str(eend, e < 0 ? -e : e, 0);
+    bool point = nd || zeros || TEST(state->feat, ALTERNATE);
+    pc[1] = (piece_t){ lbuf, point ? 2 : 1 };
+    pc[2] = (piece_t){ dbuf, nd };
+    pc[3] = (piece_t){ NULL, zeros };
+    pc[4] = (piece_t){ pbuf, 2 };
+    pc[5] = (piece_t){ es, cheri_length_get(es) };
+    return output_pieces(fn, h, pc, 6, state->width, state->feat);
+}
+
+/**
+ * Outputs `val` using one of the floating-point conversions `conv`:
+ * `f`, `e`, `g` or `a` (uppercase variants are supported too).
+ *
+ * When precision is omitted, it is 6 as in C, unless the `!` flag is
+ * given: then `f`, `e` and `g` print the shortest representation that
+ * reads back as the same value (`g` switches to the exponent form
+ * outside of [1e-4, 1e17)).
+ */
+static size_t output_fp(output_fun_t *fn, void *h, double val, char conv, const fmt_state_t *state)
+{
+    fp_bits_t bits = { .d = val };
+    uint64_t u = bits.u & ~(1ul << 63);
+    bool upper = conv >= 'A' && conv <= 'Z';
+    fmt_feat_t feat = state->feat;
+    char prefix[4], *pre = prefix;
+    if (bits.u >> 63) {
+        *(pre++) = '-';
+    } else if (TEST(feat, SIGN_PLUS)) {
+        *(pre++) = '+';
+    } else if (TEST(feat, SIGN_SPACE)) {
+        *(pre++) = ' ';
+    }
+    piece_t pc[8];
+    if (FP_EXP(u) == 0x7ff) {
+        const char *s = (u & FP_FRAC_MASK) ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf");
+        pc[0] = (piece_t){ prefix, pre - prefix };
+        pc[1] = (piece_t){ s, 3 };
+        return output_pieces(fn, h, pc, 2, state->width, feat & ~ZERO_PAD);
+    }
+    conv |= 0x20;
+    if (conv == 'a') {
+        *(pre++) = '0';
+        *(pre++) = upper ? 'X' : 'x';
+        pc[0] = (piece_t){ prefix, pre - prefix };
+        return output_hexfp(fn, h, u, pc, state, upper);
+    }
+    pc[0] = (piece_t){ prefix, pre - prefix };
+
+    char buf[FP_EXACT_DIGITS];
+    int exp10 = 0;
+    int len = u ? grisu2(u, buf, &exp10) : 0;
+    bool shortest = !TEST(feat, PRECISION) && TEST(feat, SHORTEST);
+    bool alt = TEST(feat, ALTERNATE);
+    int prec = !TEST(feat, PRECISION) ? 6 : state->precision < (1ul << 24) ? (int)state->precision : 1 << 24;
+    int p = shortest ? 17 : prec ? prec : 1; // significant digits of `g`
+    bool exact = false;
+    if (!shortest && len) {
+        int need = conv == 'g' ? p : conv == 'e' ? prec + 1 : exp10 + 1 + prec;
+        // subnormals have less precision, so padding is only exact for normals
+        if (need > FP_SHORTEST_EXACT || (need > len && FP_EXP(u) == 0)) {
+            len = fp_exact(u, buf, &exp10);
+            exact = true;
+        }
+    }
+    bool exp_form;
+    if (conv == 'g') {
+        len = fp_round(u, buf, len, &exp10, p, exact);
+        int x = len ? exp10 : 0;
+        exp_form = x < -4 || x >= p;
+        if (!shortest && alt) {
+            prec = exp_form ? p - 1 : p - 1 - x;
+        } else {
+            prec = exp_form ? len - 1 : len - 1 - x;
+            prec = prec > 0 ? prec : 0;
+        }
+    } else {
+        exp_form = conv == 'e';
+        if (shortest) {
+            prec = exp_form ? len - 1 : len - 1 - exp10;
+            prec = prec > 0 ? prec : 0;
+        } else {
+            len = fp_round(u, buf, len, &exp10, exp_form ? prec + 1 : exp10 + 1 + prec, exact);
+        }
+    }
+    if (len == 0) {
+        exp10 = 0;
+    }
+
+    size_t k = 1;
+    char ebuf[5];
+    if (exp_form) {
+        // d.ddde+xx
+        int nd = len - 1 < prec ? len - 1 : prec;
+        nd = nd > 0 ? nd : 0;
+        pc[k++] = (piece_t){ len ? buf : "0", 1 };
+        pc[k++] = (piece_t){ ".", prec || alt ? 1 : 0 };
+        pc[k++] = (piece_t){ buf + 1, nd };
+        pc[k++] = (piece_t){ NULL, prec - nd };
+        int x = exp10 < 0 ? -exp10 : exp10;
+        char *e = ebuf;
+        *(e++) = upper ? 'E' : 'e';
+        *(e++) = exp10 < 0 ? '-' : '+';
+        if (x >= 100) {
+            *(e++) = '0' + x / 100;
+            x %= 100;
+        }
+        *(e++) = dec_pairs[2 * x];
+        *(e++) = dec_pairs[2 * x + 1];
+        pc[k++] = (piece_t){ ebuf, e - ebuf };
+    } else {
+        // ddd.ddd
+        if (len && exp10 >= 0) {
+            int nd = len < exp10 + 1 ? len : exp10 + 1;
+            pc[k++] = (piece_t){ buf, nd };
+            pc[k++] = (piece_t){ NULL, exp10 + 1 - nd };
+        } else {
+            pc[k++] = (piece_t){ "0", 1 };
+        }
+        pc[k++] = (piece_t){ ".", prec || alt ? 1 : 0 };
+        int lead = 0;
+        int nd = 0;
+        if (len) {
+            lead = exp10 < -1 ? -exp10 - 1 : 0;
+            lead = lead < prec ? lead : prec;
+            int first = exp10 + 1 > 0 ? exp10 + 1 : 0;
+            int last = len < exp10 + 1 + prec ? len : exp10 + 1 + prec;
+            nd = last > first ? last - first : 0;
+            pc[k++] = (piece_t){ NULL, lead };
+            pc[k++] = (piece_t){ buf + first, nd };
+        }
+        pc[k++] = (piece_t){ NULL, prec - lead - nd };
+    }
+    return output_pieces(fn, h, pc, k, state->width, feat);
 }
 
 #define ARG(type, a) ({ nargs--; va_arg(a, type); })
 
+// tag of the capability argument just read (see `vsnprintf_tags`)
+#define ARG_TAG(cap) (tags == NULL ? cheri_tag_get(cap) \
+    : total - nargs - 1 < 64ul && ((*tags >> (total - nargs - 1)) & 1ul))
+
 /**
  * Limited implementation of printf: only selected format options are
  * supported. Anything unsupported is printed verbatim or ignored.
@@ -130,14 +1087,23 @@ static char *uint_to_str(char *end, uint64_t val, const char *digits, size_t bas
  *
  * Format: %[flags][width][.precision][length]conversion
  *
- *  - Supported flags: `#`, `0`, `-`, ` `, `+`
- *  - Width is supported
- *  - Precision is not implemented (float point conversions aren't either)
+ *  - Supported flags: `#`, `0`, `-`, ` `, `+`, `!`
+ *  - Width and precision are supported (but not `*`)
  *  - Supported length options: `l`, `z`, `t`
- *  - Supported conversions: `i`, `d`, `u`, `x`, `c`, `s`, `p`, `n`
+ *  - Supported conversions: `i`, `d`, `u`, `x`, `c`, `s`, `p`, `n`,
+ *    `f`, `e`, `g`, `a` (and `F`, `E`, `G`, `A`)
+ *
+ * Floating-point conversions with the `!` flag and without precision
+ * print the shortest representation that reads back as the same value
+ * (see `output_fp`).
  *
  * Refer to man 3 printf for more information.
  *
+ * Formatting does not allocate memory and does not recurse: integers
+ * are converted in a small local buffer (decimal digits two at a time),
+ * padding is output from constant blocks of spaces and zeros, and
+ * capabilities are rendered directly.
+ *
  * The behaviour of `p` conversion (used for pointers) can be modified:
  *  - `%#p` will print capability tag and bytes, for example:
  *     1:dc10400062d0e2a0:0000ffffe05ce2a0
@@ -145,12 +1111,15 @@ static char *uint_to_str(char *end, uint64_t val, const char *digits, size_t bas
  *     Address (hex     T  Base (hex)       Limit (hex)       Permissions        Seal Offset   Length
  *     00000000002105c5 1 [0000000000200000:0000000000233000) GrRM---xES----V--- rb   67013 of 208896
  *
+ * If `tags` is not NULL, it provides the tags printed for capabilities
+ * instead (see `vsnprintf_tags`).
  */
-static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
+static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args, const uint64_t *tags)
 {
     const char *limit = (char *)cheri_get_limit(fmt); // end of fmt string
     const void *pa = (void *)args;
     size_t nargs = pa == NULL ? 0ul : cheri_length_get(pa) / sizeof(void *); // max num of args
+    size_t total = nargs;
     char buffer[64], *end = buffer + sizeof(buffer); // tmp buffer to store integers converted to string
     int n = 0; // number of chars printed
     fmt_state_t state = { .phase = RESET }; // state of the formatter
@@ -160,10 +1129,12 @@ static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
             state.phase = IDLE;
             state.feat = NONE;
             state.width = 0;
+            state.precision = 0;
             a = p;
         } else if (state.phase == IDLE) {
             state.feat = NONE;
             state.width = 0;
+            state.precision = 0;
         }
         switch (*p) {
             case '%':
@@ -190,22 +1161,8 @@ static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
                                 } else if (!cheri_is_deref(arg)) {
                                     arg = "(invalid)";
                                 }
-                                size_t len = strlen(arg);
-                                if (len < state.width) {
-                                    bool left = TEST(state.feat, LEFT_ALIGN);
-                                    if (left) {
-                                        n += fn(h, arg, len);
-                                    }
-                                    size_t l = state.width - len;
-                                    char *pad = (char *)alloca(l);
-                                    memset(pad, ' ', l);
-                                    n += fn(h, pad, l);
-                                    if (!left) {
-                                        n += fn(h, arg, len);
-                                    }
-                                } else {
-                                    n += fn(h, arg, len);
-                                }
+                                size_t len = TEST(state.feat, PRECISION) ? strnlen(arg, state.precision) : strlen(arg);
+                                n += output_field(fn, h, arg, len, 0, state.width, state.feat & ~ZERO_PAD);
                                 state.phase = RESET;
                             } else {
                                 state.phase = IDLE;
@@ -235,32 +1192,21 @@ static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
                             if (TEST(state.feat, ALTERNATE) && TEST(state.feat, SIGN_PLUS)) {
                                 if (nargs > 0) {
                                     void *cap = (void *)ARG(void *, args);
-                                    bool tag = cheri_tag_get(cap);
-                                    size_t cap_addr = cheri_address_get(cap);
-                                    size_t cap_base = cheri_base_get(cap);
-                                    size_t cap_limit = (size_t)cheri_get_limit(cap);
-                                    ssize_t cap_offset = (ssize_t)cheri_offset_get(cap);
-                                    size_t cap_length = cheri_length_get_zero(cap);
                                     char capstr[128];
-                                    char perm[19];
-                                    char seal[5];
-                                    int sz = sprintf(capstr, "%016lx %c [%016lx:%016lx) %s %-4s %ld of %lu",
-                                        cap_addr, tag ? '1' : '0', cap_base, cap_limit,
-                                        cap_perms_to_str(perm, cap), cap_seal_to_str(seal, cap),
-                                        cap_offset, cap_length);
-                                    n += fn(h, capstr, sz);
+                                    n += fn(h, capstr, strlen(cap_to_str_tag(capstr, cap, ARG_TAG(cap))));
                                 }
                                 state.phase = RESET;
                                 break;
                             } else if (TEST(state.feat, ALTERNATE)) {
                                 if (nargs > 0) {
                                     void *cap = (void *)ARG(void *, args);
-                                    bool tag = cheri_tag_get(cap);
-                                    size_t lo = cheri_address_get(cap);
-                                    size_t hi = cheri_copy_from_high(cap);
-                                    char capstr[48];
-                                    int sz = sprintf(capstr, "%c:%016lx:%016lx", tag ? '1' : '0', hi, lo);
-                                    n += fn(h, &capstr, sz);
+                                    char capstr[35], *c = capstr;
+                                    *c++ = ARG_TAG(cap) ? '1' : '0';
+                                    *c++ = ':';
+                                    c = hex64_to_str(c, cheri_copy_from_high(cap));
+                                    *c++ = ':';
+                                    c = hex64_to_str(c, cheri_address_get(cap));
+                                    n += fn(h, capstr, c - capstr);
                                 }
                                 state.phase = RESET;
                                 break;
@@ -279,32 +1225,11 @@ static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
                                 } else {
                                     arg = (unsigned int)ARG(unsigned int, args);
                                 }
-                                char *t;
-                                if (TEST(state.feat, HEX)) {
-                                    const char *prefix = NULL;
-                                    if (TEST(state.feat, ALTERNATE)) {
-                                        prefix = "x";
-                                    }
-                                    t = uint_to_str(end, arg, hex_digits, 16, prefix);
-                                } else {
-                                    t = uint_to_str(end, arg, dec_digits, 10, NULL);
-                                }
-                                size_t len = cheri_length_get(t);
-                                if (len < state.width) {
-                                    bool left = TEST(state.feat, LEFT_ALIGN);
-                                    if (left) {
-                                        n += fn(h, t, len);
-                                    }
-                                    size_t l = state.width - len;
-                                    char *pad = (char *)alloca(l);
-                                    memset(pad, left ? ' ' : TEST(state.feat, ZERO_PAD) ? '0' : ' ', l);
-                                    n += fn(h, pad, l);
-                                    if (!left) {
-                                        n += fn(h, t, len);
-                                    }
-                                } else {
-                                    n += fn(h, t, len);
-                                }
+                                bool prefix = TEST(state.feat, HEX) && TEST(state.feat, ALTERNATE);
+                                char *t = TEST(state.feat, HEX)
+                                    ? hex_to_str(end, arg, prefix)
+                                    : dec_to_str(end, arg, 0);
+                                n += output_int(fn, h, t, prefix ? 2 : 0, arg == 0ul, &state);
                                 state.phase = RESET;
                             } else {
                                 state.phase = IDLE;
@@ -320,42 +1245,48 @@ static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
                                     arg = (int)ARG(int, args);
                                 }
                                 bool neg = arg < 0;
-                                const char *sign;
+                                char sign;
                                 if (neg) {
-                                    sign = "-";
+                                    sign = '-';
                                 } else if (TEST(state.feat, SIGN_PLUS)) {
-                                    sign = "+";
+                                    sign = '+';
                                 } else if (TEST(state.feat, SIGN_SPACE)) {
-                                    sign = " ";
-                                } else {
-                                    sign = NULL;
-                                }
-                                char *t = neg
-                                    ? uint_to_str(end, -arg, dec_digits, 10, sign)
-                                    : uint_to_str(end, arg, dec_digits, 10, sign);
-                                size_t len = cheri_length_get(t);
-                                if (!sign && len < state.width) {
-                                    bool left = TEST(state.feat, LEFT_ALIGN);
-                                    if (left) {
-                                        n += fn(h, t, len);
-                                    }
-                                    size_t l = state.width - len;
-                                    char *pad = (char *)alloca(l);
-                                    memset(pad, left ? ' ' : TEST(state.feat, ZERO_PAD) ? '0' : ' ', l);
-                                    n += fn(h, pad, l);
-                                    if (!left) {
-                                        n += fn(h, t, len);
-                                    }
+                                    sign = ' ';
                                 } else {
-                                    n += fn(h, t, len);
+                                    sign = 0;
                                 }
+                                char *t = dec_to_str(end, neg ? 0ul - (uint64_t)arg : (uint64_t)arg, sign);
+                                n += output_int(fn, h, t, sign ? 1 : 0, arg == 0l, &state);
                                 state.phase = RESET;
                             } else {
                                 state.phase = IDLE;
                             }
                             break;
+                        case 'f':
+                        case 'F':
+                        case 'e':
+                        case 'E':
+                        case 'g':
+                        case 'G':
+                        case 'a':
+                        case 'A':
+                            if (nargs > 0) {
+                                double arg = (double)ARG(double, args);
+                                n += output_fp(fn, h, arg, *p, &state);
+                                state.phase = RESET;
+                            } else {
+                                state.phase = IDLE;
+                            }
+                            break;
+                        case '.':
+                            state.feat |= PRECISION;
+                            state.precision = 0;
+                            break;
                         case '0':
-                            if (state.width) {
+                            if (TEST(state.feat, PRECISION)) {
+                                state.precision = 10 * state.precision;
+                                break;
+                            } else if (state.width) {
                                 state.width = 10 * state.width;
                                 break;
                             } else {
@@ -371,7 +1302,11 @@ static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
                         case '7':
                         case '8':
                         case '9':
-                            state.width = 10 * state.width + ((size_t)(*p) - '0');
+                            if (TEST(state.feat, PRECISION)) {
+                                state.precision = 10 * state.precision + ((size_t)(*p) - '0');
+                            } else {
+                                state.width = 10 * state.width + ((size_t)(*p) - '0');
+                            }
                             break;
                         case '-':
                             state.feat |= LEFT_ALIGN;
@@ -390,6 +1325,9 @@ static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
                         case '#':
                             state.feat |= ALTERNATE;
                             break;
+                        case '!':
+                            state.feat |= SHORTEST;
+                            break;
                         default:
                             // print unsupported format strings verbatim
                             state.phase = IDLE;
@@ -405,3 +1343,68 @@ static int printf_core(output_fun_t *fn, void *h, const char *fmt, va_list args)
     }
     return n;
 }
+
+/**
+ * Formats arguments prepared by the `print` and `sprint` macros. Every
+ * argument already carries its conversion, chosen at compile time from
+ * its type, so there is no format string to parse and no variadic
+ * arguments to count: only the conversions themselves are done. The
+ * output is the same as that of the equivalent `printf`.
+ */
+static int print_core(output_fun_t *fn, void *h, const print_arg_t *args, size_t count)
+{
+    char buffer[64], *end = buffer + sizeof(buffer);
+    int n = 0;
+    size_t tail = cheri_get_tail(args) / sizeof(print_arg_t);
+    if (count > tail) {
+        count = tail;
+    }
+    for (size_t k = 0; k < count; k++) {
+        const print_arg_t *a = &args[k];
+        switch (a->type) {
+            case PRINT_INT:
+            {
+                bool neg = a->i < 0;
+                char *t = dec_to_str(end, neg ? 0ul - (uint64_t)a->i : (uint64_t)a->i, neg ? '-' : 0);
+                n += fn(h, t, cheri_length_get(t));
+                break;
+            }
+            case PRINT_UINT:
+            {
+                char *t = dec_to_str(end, a->u, 0);
+                n += fn(h, t, cheri_length_get(t));
+                break;
+            }
+            case PRINT_HEX:
+            {
+                char *t = hex_to_str(end, a->u, true);
+                n += fn(h, t, cheri_length_get(t));
+                break;
+            }
+            case PRINT_CHAR:
+            {
+                unsigned char c = (unsigned char)a->u;
+                n += fn(h, &c, 1);
+                break;
+            }
+            case PRINT_STR:
+            {
+                const char *str = a->s;
+                if (str == NULL) {
+                    str = "(null)";
+                } else if (!cheri_is_deref(str)) {
+                    str = "(invalid)";
+                }
+                n += fn(h, str, strlen(str));
+                break;
+            }
+            case PRINT_CAP:
+            {
+                char capstr[128];
+                n += fn(h, capstr, strlen(cap_to_str(capstr, a->p)));
+                break;
+            }
+        }
+    }
+    return n;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "morello.h"
+
+/**
+ * Streaming record reader.
+ *
+ * Data is read from a file descriptor into a large buffer and split
+ * into records by a delimiter (for example '\n' for lines). Records are
+ * returned as read-only capabilities pointing into the buffer and
+ * bounded to the record, without the delimiter and without copying.
+ * Such views are not NUL-terminated, but the string functions and
+ * `printf("%s")` treat the capability limit as the end of the string.
+ *
+ * A view is valid until the next call to `reader_next`: the unread
+ * part of the buffer is moved to its start before refilling, and the
+ * buffer is grown (doubled) when a single record does not fit.
+ *
+ * Bounds are exact when the record length is representable, otherwise
+ * (only for very long records) they may be slightly larger and the
+ * length returned by `reader_next` must be used.
+ */
+
+/**
+ * Initialises reader `r` for file descriptor `fd` splitting records
+ * at `delim`. The buffer will initially hold `size` bytes (or
+ * READER_BUFSIZE if `size` is 0). Returns 0 on success.
+ */
+int reader_init(reader_t *r, int fd, int delim, size_t size)
+{
+    if (cheri_get_tail(r) < sizeof(reader_t)) {
+        return -1;
+    }
+    r->buf = malloc(size ? size : READER_BUFSIZE);
+    if (r->buf == NULL) {
+        return -1;
+    }
+    r->fd = fd;
+    r->delim = (unsigned char)delim;
+    r->size = cheri_length_get(r->buf);
+    r->start = r->scan = r->end = 0ul;
+    r->eof = false;
+    r->error = 0;
+    return 0;
+}
+
+void reader_free(reader_t *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+    r->size = r->start = r->scan = r->end = 0ul;
+}
+
+/**
+ * Makes room in the buffer and reads more data. Returns false at the
+ * end of input or on error.
+ */
+static bool reader_fill(reader_t *r)
+{
+    if (r->eof) {
+        return false;
+    }
+    if (r->start > 0ul) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->scan -= r->start;
+        r->start = 0ul;
+    }
+    if (r->end == r->size) {
+        char *buf = realloc(r->buf, 2 * r->size);
+        if (buf == NULL) {
+            r->error = -1;
+            return false;
+        }
+        r->buf = buf;
+        r->size = cheri_length_get(buf);
+    }
+    ssize_t n = read(r->fd, r->buf + r->end, r->size - r->end);
+    if (n <= 0) {
+        r->eof = true;
+        r->error = n < 0 ? (int)n : 0;
+        return false;
+    }
+    r->end += n;
+    return true;
+}
+
+static const char *reader_view(reader_t *r, size_t start, size_t len)
+{
+    const char *p = r->buf + start;
+    if (cheri_representable_length(len) == len && !(cheri_address_get(p) & ~cheri_representable_alignment_mask(len))) {
+        p = cheri_bounds_set_exact(p, len);
+    } else {
+        p = cheri_bounds_set(p, len);
+    }
+    return cheri_perms_and(p, PERM_GLOBAL | PERM_LOAD);
+}
+
+/**
+ * Returns the next record and stores its length (without the
+ * delimiter) in `len`. The last record may have no delimiter. Returns
+ * NULL when there are no more records or on error (see `r->error`).
+ */
+const char *reader_next(reader_t *r, size_t *len)
+{
+    for (;;) {
+        // only the newly read part of the buffer needs scanning
+        const char *d = memchr(r->buf + r->scan, r->delim, r->end - r->scan);
+        if (d != NULL) {
+            size_t start = r->start;
+            size_t stop = cheri_address_get(d) - cheri_address_get(r->buf);
+            r->start = r->scan = stop + 1;
+            *len = stop - start;
+            return reader_view(r, start, *len);
+        }
+        r->scan = r->end;
+        if (!reader_fill(r)) {
+            break;
+        }
+    }
+    if (r->start < r->end) {
+        size_t start = r->start;
+        *len = r->end - start;
+        r->start = r->scan = r->end;
+        return reader_view(r, start, *len);
+    }
+    *len = 0ul;
+    return NULL;
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "morello.h"
+
+/**
+ * Sorting and searching.
+ *
+ * Elements are moved in capability-sized units whenever the array and
+ * the element size are 16-byte aligned, so structures that contain
+ * capabilities keep their tags when they are sorted. Other layouts are
+ * moved in 8-byte words or bytes. The number of elements is clamped to
+ * the bounds of the array.
+ */
+
+#define INSERTION_SORT_MAX 16
+
+static void swap_elems(char *a, char *b, size_t size)
+{
+    if (((cheri_address_get(a) | cheri_address_get(b) | size) & (sizeof(void *) - 1)) == 0ul) {
+        void **x = (void **)a, **y = (void **)b;
+        for (size_t k = 0; k < size / sizeof(void *); k++) {
+            void *t = x[k];
+            x[k] = y[k];
+            y[k] = t;
+        }
+    } else if (((cheri_address_get(a) | cheri_address_get(b) | size) & 7ul) == 0ul) {
+        uint64_t *x = (uint64_t *)a, *y = (uint64_t *)b;
+        for (size_t k = 0; k < size / 8; k++) {
+            uint64_t t = x[k];
+            x[k] = y[k];
+            y[k] = t;
+        }
+    } else {
+        for (size_t k = 0; k < size; k++) {
+            char t = a[k];
+            a[k] = b[k];
+            b[k] = t;
+        }
+    }
+}
+
+static size_t clamp_count(const void *base, size_t nmemb, size_t size)
+{
+    size_t max = size ? cheri_get_tail(base) / size : 0ul;
+    return nmemb < max ? nmemb : max;
+}
+
+static void insertion_sort(char *base, size_t n, size_t size, int (*cmp)(const void *, const void *))
+{
+    for (size_t i = 1; i < n; i++) {
+        for (char *p = base + i * size; p > base && cmp(p - size, p) > 0; p -= size) {
+            swap_elems(p - size, p, size);
+        }
+    }
+}
+
+static void sift_down(char *base, size_t root, size_t n, size_t size, int (*cmp)(const void *, const void *))
+{
+    for (size_t child; (child = 2 * root + 1) < n; root = child) {
+        if (child + 1 < n && cmp(base + child * size, base + (child + 1) * size) < 0) {
+            child++;
+        }
+        if (cmp(base + root * size, base + child * size) >= 0) {
+            break;
+        }
+        swap_elems(base + root * size, base + child * size, size);
+    }
+}
+
+static void heap_sort(char *base, size_t n, size_t size, int (*cmp)(const void *, const void *))
+{
+    for (size_t k = n / 2; k > 0; k--) {
+        sift_down(base, k - 1, n, size, cmp);
+    }
+    for (size_t k = n - 1; k > 0; k--) {
+        swap_elems(base, base + k * size, size);
+        sift_down(base, 0, k, size, cmp);
+    }
+}
+
+/**
+ * Quicksort with the median of three as pivot. Recursion goes into the
+ * smaller partition only, and after `depth` levels the remaining part
+ * is sorted with heap sort, so the worst case is O(n log n). Small
+ * partitions are finished with insertion sort.
+ */
+static void intro_sort(char *base, size_t n, size_t size, int (*cmp)(const void *, const void *), size_t depth)
+{
+    while (n > INSERTION_SORT_MAX) {
+        if (depth == 0) {
+            heap_sort(base, n, size, cmp);
+            return;
+        }
+        depth--;
+        char *mid = base + (n / 2) * size, *last = base + (n - 1) * size;
+        if (cmp(mid, base) < 0) {
+            swap_elems(mid, base, size);
+        }
+        if (cmp(last, mid) < 0) {
+            swap_elems(last, mid, size);
+            if (cmp(mid, base) < 0) {
+                swap_elems(mid, base, size);
+            }
+        }
+        // the pivot is kept at the start while partitioning the rest
+        swap_elems(base, mid, size);
+        size_t i = 0, j = n;
+        for (;;) {
+            do {
+                i++;
+            } while (i < n - 1 && cmp(base + i * size, base) < 0);
+            do {
+                j--;
+            } while (cmp(base, base + j * size) < 0);
+            if (i >= j) {
+                break;
+            }
+            swap_elems(base + i * size, base + j * size, size);
+        }
+        swap_elems(base, base + j * size, size);
+        size_t left = j, right = n - j - 1;
+        if (left < right) {
+            intro_sort(base, left, size, cmp, depth);
+            base += (j + 1) * size;
+            n = right;
+        } else {
+            intro_sort(base + (j + 1) * size, right, size, cmp, depth);
+            n = left;
+        }
+    }
+    insertion_sort(base, n, size, cmp);
+}
+
+void qsort(void *base, size_t nmemb, size_t size, int (*compar)(const void *, const void *))
+{
+    size_t n = clamp_count(base, nmemb, size);
+    size_t depth = 0;
+    for (size_t k = n; k > 1; k >>= 1) {
+        depth += 2;
+    }
+    intro_sort(base, n, size, compar, depth);
+}
+
+void *bsearch(const void *key, const void *base, size_t nmemb, size_t size, int (*compar)(const void *, const void *))
+{
+    const char *lo = base;
+    for (size_t n = clamp_count(base, nmemb, size); n > 0;) {
+        const char *mid = lo + (n / 2) * size;
+        int c = compar(key, mid);
+        if (c == 0) {
+            return (void *)mid;
+        } else if (c > 0) {
+            lo = mid + size;
+            n -= n / 2 + 1;
+        } else {
+            n /= 2;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Sorts `nmemb` elements of `size` bytes by the address of the
+ * capability stored at `offset` within each element, using LSD radix
+ * sort with one pass per byte of the address. Passes over bytes that
+ * are the same in all addresses (typically the upper ones) are
+ * skipped. The sort is stable. The array, `size` and `offset` must be
+ * 16-byte aligned, so elements are copied with their tags. Returns 0 on
+ * success or negative error code.
+ */
+int sort_by_address(void *base, size_t nmemb, size_t size, size_t offset)
+{
+    size_t n = clamp_count(base, nmemb, size);
+    if (offset + sizeof(void *) > size
+        || ((cheri_address_get(base) | size | offset) & (sizeof(void *) - 1)) != 0ul) {
+        return -EINVAL;
+    }
+    if (n < 2) {
+        return 0;
+    }
+    char *tmp = malloc(n * size);
+    if (tmp == NULL) {
+        return -ENOMEM;
+    }
+    // histograms for all passes at once
+    size_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    char *src = base;
+    for (size_t k = 0; k < n; k++) {
+        uint64_t addr = cheri_address_get(*(void **)(src + k * size + offset));
+        for (size_t b = 0; b < 8; b++) {
+            counts[b][(addr >> (8 * b)) & 0xfful]++;
+        }
+    }
+    char *dst = tmp;
+    for (size_t b = 0; b < 8; b++) {
+        size_t *c = counts[b];
+        size_t first = (cheri_address_get(*(void **)(src + offset)) >> (8 * b)) & 0xfful;
+        if (c[first] == n) {
+            continue;
+        }
+        for (size_t d = 0, sum = 0; d < 256; d++) {
+            size_t t = c[d];
+            c[d] = sum;
+            sum += t;
+        }
+        for (size_t k = 0; k < n; k++) {
+            char *e = src + k * size;
+            uint64_t addr = cheri_address_get(*(void **)(e + offset));
+            memcpy(dst + c[(addr >> (8 * b)) & 0xfful]++ * size, e, size);
+        }
+        char *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != base) {
+        memcpy(base, src, n * size);
+    }
+    free(tmp);
+    return 0;
+}
@@ -7,6 +7,82 @@
 #include "libc.h"
 #include "morello.h"
 
+/**
+ * Word-at-a-time helpers. The string functions below scan memory in
+ * 64-bit words, two words (16 bytes) per iteration. The scanning
+ * pointer is first aligned to 8 bytes using a byte loop, and words
+ * are only loaded while the whole word is below the limit of the
+ * capability, the rest is done by a byte loop again. This way no load
+ * ever leaves the capability's bounds.
+ *
+ * `has_zero(w)` is non-zero iff `w` contains a zero byte, and its lowest
+ * set bit is the top bit of the first (in memory order) zero byte.
+ */
+#define ONES  0x0101010101010101ul
+#define HIGHS 0x8080808080808080ul
+
+// 64-bit word that may be loaded from an unaligned address
+typedef uint64_t __attribute__((aligned(1), may_alias)) uword_t;
+
+static inline uint64_t has_zero(uint64_t w)
+{
+    return (w - ONES) & ~w & HIGHS;
+}
+
+static inline size_t first_byte(uint64_t mask)
+{
+    return __builtin_ctzl(mask) >> 3;
+}
+
+#define IS_ALIGNED(p, a) ((cheri_address_get(p) & ((a) - 1)) == 0ul)
+
+/**
+ * Returns pointer to the first occurrence of `c` within [p, lim) or
+ * `lim` if there is none.
+ */
+static const char *scan_byte(const char *p, const char *lim, unsigned char c)
+{
+    for (; p < lim && !IS_ALIGNED(p, sizeof(uint64_t)); p++) {
+        if (*(unsigned char *)p == c) {
+            return p;
+        }
+    }
+    uint64_t pat = ONES * c;
+    for (; lim - p >= 2 * (ptrdiff_t)sizeof(uint64_t); p += 2 * sizeof(uint64_t)) {
+        const uint64_t *w = (const uint64_t *)p;
+        uint64_t m0 = has_zero(w[0] ^ pat);
+        uint64_t m1 = has_zero(w[1] ^ pat);
+        if (m0) {
+            return p + first_byte(m0);
+        } else if (m1) {
+            return p + sizeof(uint64_t) + first_byte(m1);
+        }
+    }
+    for (; p < lim; p++) {
+        if (*(unsigned char *)p == c) {
+            return p;
+        }
+    }
+    return lim;
+}
+
+/**
+ * A "safe" strnlen that would not do an out-of-bounds access.
+ * String length is counted from `src` till either a null-
+ * terminator, `maxlen` characters or the limit of the capability.
+ *
+ * A NULL or invalid pointer is treated like an empty string.
+ */
+size_t strnlen(const char *str, size_t maxlen)
+{
+    if (!str || !cheri_is_deref(str)) return 0ul;
+    size_t max = cheri_get_tail(str);
+    if (maxlen > max) {
+        maxlen = max;
+    }
+    return scan_byte(str, str + maxlen, '\0') - str;
+}
+
 /**
  * A "safe" strlen that would not do an out-of-bounds access.
  * String length is counted from `src` till either a null-
@@ -17,9 +93,7 @@
 size_t strlen(const char *str)
 {
     if (!str || !cheri_is_deref(str)) return 0ul;
-    size_t k, max = cheri_get_tail(str);
-    for (k = 0; k < max && *str; str++, k++);
-    return k;
+    return scan_byte(str, str + cheri_get_tail(str), '\0') - str;
 }
 
 /**
@@ -34,6 +108,18 @@ char *strcpy(char *dst, const char *src)
 {
     const char *dst_lim = cheri_get_limit(dst);
     const char *src_lim = cheri_get_limit(src);
+    for(; dst < dst_lim && src < src_lim && *src && !IS_ALIGNED(src, sizeof(uint64_t)); dst++, src++) {
+        *dst = *src;
+    }
+    for(; dst_lim - dst >= (ptrdiff_t)sizeof(uint64_t)
+        && src_lim - src >= (ptrdiff_t)sizeof(uint64_t);
+        dst += sizeof(uint64_t), src += sizeof(uint64_t)) {
+        uint64_t w = *(const uword_t *)src;
+        if (has_zero(w)) {
+            break;
+        }
+        *(uword_t *)dst = w;
+    }
     for(; dst < dst_lim && src < src_lim && *src; dst++, src++) {
         *dst = *src;
     }
@@ -53,6 +139,16 @@ int strcmp(const char *lhs, const char *rhs)
 {
     const char *lhs_lim = (char *)cheri_get_limit(lhs);
     const char *rhs_lim = (char *)cheri_get_limit(rhs);
+    for(; lhs < lhs_lim && rhs < rhs_lim && *lhs == *rhs && *lhs && !IS_ALIGNED(lhs, sizeof(uint64_t)); lhs++, rhs++);
+    for(; lhs_lim - lhs >= (ptrdiff_t)sizeof(uint64_t)
+        && rhs_lim - rhs >= (ptrdiff_t)sizeof(uint64_t);
+        lhs += sizeof(uint64_t), rhs += sizeof(uint64_t)) {
+        uint64_t l = *(const uword_t *)lhs;
+        uint64_t r = *(const uword_t *)rhs;
+        if (l != r || has_zero(l)) {
+            break;
+        }
+    }
     for(; lhs < lhs_lim && rhs < rhs_lim && *lhs == *rhs && *lhs; lhs++, rhs++);
     if (lhs < lhs_lim && rhs < rhs_lim) {
         return *(unsigned char *)lhs - *(unsigned char *)rhs;
@@ -66,7 +162,130 @@ int strcmp(const char *lhs, const char *rhs)
 }
 
 /**
- * A simple bounds-checking memset.
+ * A "safe" strchr: looks for the character `c` till either
+ * a null-terminator or the limit of the capability. Returns
+ * NULL if the character is not found. Searching for '\0'
+ * returns pointer to the terminator if it is within bounds.
+ */
+char *strchr(const char *str, int c)
+{
+    if (!str || !cheri_is_deref(str)) return NULL;
+    const char *p = str, *lim = str + cheri_get_tail(str);
+    unsigned char ch = c;
+    for (; p < lim && !IS_ALIGNED(p, sizeof(uint64_t)); p++) {
+        if (*(unsigned char *)p == ch) {
+            return (char *)p;
+        } else if (*p == '\0') {
+            return NULL;
+        }
+    }
+    uint64_t pat = ONES * ch;
+    for (; lim - p >= 2 * (ptrdiff_t)sizeof(uint64_t); p += 2 * sizeof(uint64_t)) {
+        const uint64_t *w = (const uint64_t *)p;
+        uint64_t m = has_zero(w[0]) | has_zero(w[0] ^ pat)
+            | has_zero(w[1]) | has_zero(w[1] ^ pat);
+        if (m) {
+            break;
+        }
+    }
+    for (; p < lim; p++) {
+        if (*(unsigned char *)p == ch) {
+            return (char *)p;
+        } else if (*p == '\0') {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * A "safe" memchr: the search is limited to the first `len`
+ * bytes or the limit of the capability whichever comes first.
+ */
+void *memchr(const void *src, int c, size_t len)
+{
+    if (!src || !cheri_is_deref(src)) return NULL;
+    size_t max = cheri_get_tail(src);
+    if (len > max) {
+        len = max;
+    }
+    const char *lim = (const char *)src + len;
+    const char *p = scan_byte(src, lim, c);
+    return p < lim ? (void *)p : NULL;
+}
+
+/**
+ * A "safe" memcmp: only the first `len` bytes that are within
+ * bounds of both capabilities are compared.
+ */
+int memcmp(const void *lhs, const void *rhs, size_t len)
+{
+    size_t max_lhs = cheri_get_tail(lhs);
+    size_t max_rhs = cheri_get_tail(rhs);
+    if (len > max_lhs) {
+        len = max_lhs;
+    }
+    if (len > max_rhs) {
+        len = max_rhs;
+    }
+    const unsigned char *l = lhs, *r = rhs, *lim = l + len;
+    for (; l < lim && !IS_ALIGNED(l, sizeof(uint64_t)); l++, r++) {
+        if (*l != *r) {
+            return *l - *r;
+        }
+    }
+    for (; lim - l >= (ptrdiff_t)sizeof(uint64_t); l += sizeof(uint64_t), r += sizeof(uint64_t)) {
+        uint64_t x = *(const uint64_t *)l ^ *(const uword_t *)r;
+        if (x) {
+            size_t k = first_byte(x);
+            return l[k] - r[k];
+        }
+    }
+    for (; l < lim; l++, r++) {
+        if (*l != *r) {
+            return *l - *r;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Tuning parameters for `memset`, selected once by `init_tuning`
+ * (called from `init`). The defaults are safe to use before that:
+ * DC ZVA is disabled.
+ */
+static libc_tuning_t tuning = {
+    .zva_threshold = ~0ul,
+};
+
+/**
+ * Selects the DC ZVA threshold of `memset`. DC ZVA is used for zeroing
+ * large blocks if it is permitted (DCZID_EL0) and its block size is sane.
+ */
+void init_tuning()
+{
+    uint64_t dczid;
+    __asm__ ("mrs %0, dczid_el0\n" : "=r"(dczid));
+    size_t zva = 4ul << (dczid & 0xf);
+    if ((dczid & 0x10) == 0ul && zva >= 16ul && zva <= 2048ul) {
+        tuning.zva_size = zva;
+        // aligning to the block is paid for by at least a few blocks
+        tuning.zva_threshold = 4 * zva > 256ul ? 4 * zva : 256ul;
+    } else {
+        tuning.zva_size = 0ul;
+        tuning.zva_threshold = ~0ul;
+    }
+}
+
+const libc_tuning_t *get_libc_tuning()
+{
+    return &tuning;
+}
+
+/**
+ * A simple bounds-checking memset. Large blocks of zeros are cleared
+ * with DC ZVA (whole blocks only, so the capability bounds of `dst`
+ * always cover the cleared memory).
  */
 void *memset(void *dst, int c, size_t len)
 {
@@ -90,12 +309,26 @@ void *memset(void *dst, int c, size_t len)
     for(char *x = head; x < head_end; x++) {
         *x = c;
     }
-    uint64_t b = c;
-    uint64_t t = (b << 56) | (b << 48) | (b << 40) | (b << 32) | (b << 24) | (b << 16) | (b << 8) | b;
-    for(uint64_t *x = (uint64_t *)head_end; x < (uint64_t *)tail; x+=2) {
+    uint64_t t = (unsigned char)c * ONES;
+    if (c == 0 && len >= tuning.zva_threshold) {
+        char *zva = cheri_align_up(head_end, tuning.zva_size);
+        char *zva_end = cheri_align_down(tail, tuning.zva_size);
+        for(uint64_t *x = (uint64_t *)head_end; x < (uint64_t *)zva; x++) {
+            *x = 0ul;
+        }
+        for(char *x = zva; x < zva_end; x += tuning.zva_size) {
+            __asm__ __volatile__ ("dc zva, %0\n" :: "C"(x) : "memory");
+        }
+        head_end = zva_end;
+    }
+    uint64_t *x = (uint64_t *)head_end;
+    for(; x + 2 <= (uint64_t *)tail; x += 2) {
         x[0] = t;
         x[1] = t;
     }
+    if (x < (uint64_t *)tail) {
+        *x = t;
+    }
 tail:
     for(char *x = tail; x < tail_end; x++) {
         *x = c;
@@ -103,15 +336,174 @@ tail:
     return dst;
 }
 
+typedef void *cap_t;
+
 /**
- * A simple bounds-checking and capability-aware memcpy.
- * All 16-byte aligned blocks will be copied as capabilities
- * preserving memory tags unless the source and the destination
- * are misaligned.
+ * Copies `len` bytes from `s` to `d` moving forward. This is also
+ * used by memmove when the destination is below the source: every
+ * word is loaded before the destination word at the same or lower
+ * address is stored.
+ *
+ * There are three strategies depending on relative alignment:
+ *  - Same 16-byte alignment: the bulk is copied as capabilities in
+ *    unrolled pairs (LDP/STP), preserving memory tags.
+ *  - Same 8-byte alignment: the bulk is copied as 64-bit words.
+ *  - Otherwise: destination is aligned and every destination word is
+ *    merged from two aligned source words using shifts.
+ *
+ * All loads stay within [s, s + len) and all stores within [d, d + len),
+ * so both capabilities must only cover the copied ranges.
  */
-void *memcpy(void *dst, const void *src, size_t len)
+static void copy_forward(char *d, const char *s, size_t len, bool caps)
+{
+    const char *end = s + len;
+    uint64_t rel = (cheri_address_get(d) ^ cheri_address_get(s));
+    if (caps && (rel & 0xful) == 0ul && len >= 2 * sizeof(cap_t)) {
+        for (; !IS_ALIGNED(s, sizeof(cap_t)); d++, s++) {
+            *d = *s;
+        }
+        cap_t *dc = (cap_t *)d;
+        const cap_t *sc = (const cap_t *)s;
+        size_t n = (end - s) / sizeof(cap_t);
+        for (; n >= 4; n -= 4, dc += 4, sc += 4) {
+            cap_t c0 = sc[0], c1 = sc[1];
+            cap_t c2 = sc[2], c3 = sc[3];
+            dc[0] = c0; dc[1] = c1;
+            dc[2] = c2; dc[3] = c3;
+        }
+        for (; n > 0; n--, dc++, sc++) {
+            *dc = *sc;
+        }
+        d = (char *)dc;
+        s = (const char *)sc;
+    } else if ((rel & 0x7ul) == 0ul && len >= 2 * sizeof(uint64_t)) {
+        for (; !IS_ALIGNED(s, sizeof(uint64_t)); d++, s++) {
+            *d = *s;
+        }
+        uint64_t *dw = (uint64_t *)d;
+        const uint64_t *sw = (const uint64_t *)s;
+        size_t n = (end - s) / sizeof(uint64_t);
+        for (; n >= 4; n -= 4, dw += 4, sw += 4) {
+            uint64_t w0 = sw[0], w1 = sw[1];
+            uint64_t w2 = sw[2], w3 = sw[3];
+            dw[0] = w0; dw[1] = w1;
+            dw[2] = w2; dw[3] = w3;
+        }
+        for (; n > 0; n--, dw++, sw++) {
+            *dw = *sw;
+        }
+        d = (char *)dw;
+        s = (const char *)sw;
+    } else if (len >= 4 * sizeof(uint64_t)) {
+        const char *start = s;
+        for (; !IS_ALIGNED(d, sizeof(uint64_t)); d++, s++) {
+            *d = *s;
+        }
+        // The first aligned source word must not start below `start`:
+        size_t k = cheri_address_get(s) & 0x7ul;
+        if ((size_t)(s - start) < k) {
+            for (size_t i = 0; i < sizeof(uint64_t); i++, d++, s++) {
+                *d = *s;
+            }
+        }
+        unsigned rs = 8 * k, ls = 64 - rs;
+        uint64_t *dw = (uint64_t *)d;
+        const uint64_t *sw = (const uint64_t *)(s - k);
+        uint64_t w0 = sw[0];
+        // Load the next source word only while it is within the range:
+        for (; (const char *)(sw + 2) <= end; sw++, dw++) {
+            uint64_t w1 = sw[1];
+            *dw = (w0 >> rs) | (w1 << ls);
+            w0 = w1;
+        }
+        d = (char *)dw;
+        s = (const char *)sw + k;
+    }
+    for (; s < end; d++, s++) {
+        *d = *s;
+    }
+}
+
+/**
+ * Copies `len` bytes from `s` to `d` moving backward. Used by memmove
+ * when the destination overlaps the source from above.
+ */
+static void copy_backward(char *d, const char *s, size_t len, bool caps)
+{
+    const char *start = s;
+    d += len;
+    s += len;
+    uint64_t rel = (cheri_address_get(d) ^ cheri_address_get(s));
+    if (caps && (rel & 0xful) == 0ul && len >= 2 * sizeof(cap_t)) {
+        for (; !IS_ALIGNED(s, sizeof(cap_t)); ) {
+            *--d = *--s;
+        }
+        cap_t *dc = (cap_t *)d;
+        const cap_t *sc = (const cap_t *)s;
+        size_t n = (s - start) / sizeof(cap_t);
+        for (; n >= 2; n -= 2) {
+            dc -= 2; sc -= 2;
+            cap_t c0 = sc[0], c1 = sc[1];
+            dc[0] = c0; dc[1] = c1;
+        }
+        for (; n > 0; n--) {
+            *--dc = *--sc;
+        }
+        d = (char *)dc;
+        s = (const char *)sc;
+    } else if ((rel & 0x7ul) == 0ul && len >= 2 * sizeof(uint64_t)) {
+        for (; !IS_ALIGNED(s, sizeof(uint64_t)); ) {
+            *--d = *--s;
+        }
+        uint64_t *dw = (uint64_t *)d;
+        const uint64_t *sw = (const uint64_t *)s;
+        size_t n = (s - start) / sizeof(uint64_t);
+        for (; n >= 2; n -= 2) {
+            dw -= 2; sw -= 2;
+            uint64_t w0 = sw[0], w1 = sw[1];
+            dw[0] = w0; dw[1] = w1;
+        }
+        for (; n > 0; n--) {
+            *--dw = *--sw;
+        }
+        d = (char *)dw;
+        s = (const char *)sw;
+    } else if (len >= 4 * sizeof(uint64_t)) {
+        const char *end = s;
+        for (; !IS_ALIGNED(d, sizeof(uint64_t)); ) {
+            *--d = *--s;
+        }
+        // The last aligned source word must not end above `end`:
+        size_t k = cheri_address_get(s) & 0x7ul;
+        if ((size_t)(end - s) < sizeof(uint64_t) - k) {
+            for (size_t i = 0; i < sizeof(uint64_t); i++) {
+                *--d = *--s;
+            }
+        }
+        unsigned rs = 8 * k, ls = 64 - rs;
+        uint64_t *dw = (uint64_t *)d;
+        const uint64_t *sw = (const uint64_t *)(s - k);
+        uint64_t w1 = sw[0];
+        // Load the previous source word only while it is within the range:
+        for (; (const char *)(sw - 1) >= start; sw--) {
+            uint64_t w0 = sw[-1];
+            *--dw = (w0 >> rs) | (w1 << ls);
+            w1 = w0;
+        }
+        d = (char *)dw;
+        s = (const char *)sw + k;
+    }
+    while (s > start) {
+        *--d = *--s;
+    }
+}
+
+/**
+ * Clamps the length of a copy operation to the tails of both
+ * capabilities, so the copy never goes out of bounds.
+ */
+static size_t copy_len(const void *dst, const void *src, size_t len)
 {
-    void *res = dst;
     size_t max_dst = cheri_get_tail(dst);
     size_t max_src = cheri_get_tail(src);
     if (len > max_dst) {
@@ -120,31 +512,56 @@ void *memcpy(void *dst, const void *src, size_t len)
     if (len > max_src) {
         len = max_src;
     }
+    return len;
+}
+
+/**
+ * A simple bounds-checking and capability-aware memcpy.
+ * All 16-byte aligned blocks will be copied as capabilities
+ * preserving memory tags if the source and the destination
+ * have the same alignment and the destination capability
+ * permits storing capabilities. Misaligned copies are done
+ * using 64-bit words.
+ */
+void *memcpy(void *dst, const void *src, size_t len)
+{
+    len = copy_len(dst, src, len);
+    if (len) {
+        copy_forward(dst, src, len, cheri_check_perms(dst, PERM_STORE_CAP));
+    }
+    return dst;
+}
+
+/**
+ * Same as memcpy but returns a pointer to the byte following
+ * the last copied one.
+ */
+void *mempcpy(void *dst, const void *src, size_t len)
+{
+    len = copy_len(dst, src, len);
+    if (len) {
+        copy_forward(dst, src, len, cheri_check_perms(dst, PERM_STORE_CAP));
+    }
+    return (char *)dst + len;
+}
+
+/**
+ * Capability-aware memmove: same as memcpy but the source and
+ * the destination may overlap.
+ */
+void *memmove(void *dst, const void *src, size_t len)
+{
+    len = copy_len(dst, src, len);
     if (len == 0ul) {
-        return res;
+        return dst;
     }
-    bool misaligned = (((uint64_t)dst) & 0xful) != (((uint64_t)src) & 0xful);
-    if (misaligned || len < sizeof(void *)) { // copy bytes
-        char *d = (char *)dst;
-        char *s = (char *)src;
-        for(size_t k = 0; k < len; d++, s++, k++) {
-            *d = *s;
-        }
-    } else { // capability-aware copying
-        char *head = (char *)src;
-        char *head_end = cheri_align_up(head, sizeof(void *));
-        char *tail_end = head + len;
-        char *tail = cheri_align_down(tail_end, sizeof(void *));
-        char *d = dst;
-        for(char *s = head; s < head_end; d++, s++) {
-            *d = *s;
-        }
-        for(void **s = (void **)head_end; s < (void **)tail; d += sizeof(void *), s++) {
-            *((void **)d) = *s;
-        }
-        for(char *s = tail; s < tail_end; d++, s++) {
-            *d = *s;
-        }
+    size_t d = cheri_address_get(dst);
+    size_t s = cheri_address_get(src);
+    bool caps = cheri_check_perms(dst, PERM_STORE_CAP);
+    if (d > s && d < s + len) {
+        copy_backward(dst, src, len, caps);
+    } else if (d != s) {
+        copy_forward(dst, src, len, caps);
     }
-    return res;
+    return dst;
 }
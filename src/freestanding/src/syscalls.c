@@ -9,6 +9,7 @@
 
 void exit(int code)
 {
+    fflush(NULL);
     register intptr_t c8 __asm__("c8") = SYS_EXIT_GROUP;
     register intptr_t c0 __asm__("c0") = code;
     __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0));
@@ -32,15 +33,105 @@ ssize_t write(int fd, const void *buf, size_t count)
     return c0;
 }
 
-void *mmap(void *addr, size_t len, int prot, int flags)
+ssize_t read(int fd, void *buf, size_t count)
+{
+    size_t tail = cheri_get_tail(buf);
+    if (count > tail) {
+        count = tail;
+    }
+    if (count == 0ul) {
+        return 0ul;
+    }
+    register intptr_t c8 __asm__("c8") = SYS_READ;
+    register intptr_t c0 __asm__("c0") = fd;
+    register intptr_t c1 __asm__("c1") = (intptr_t)buf;
+    register intptr_t c2 __asm__("c2") = count;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1), "C"(c2) : "memory");
+    return c0;
+}
+
+/**
+ * Opens a file relative to directory `dirfd` (or the current
+ * directory if it is AT_FDCWD). The path must be terminated within
+ * the bounds of its capability. Returns file descriptor or negative
+ * error code.
+ */
+int openat(int dirfd, const char *path, int flags, int mode)
+{
+    size_t tail = cheri_get_tail(path);
+    if (strnlen(path, tail) == tail) {
+        return -EFAULT;
+    }
+    register intptr_t c8 __asm__("c8") = SYS_OPENAT;
+    register intptr_t c0 __asm__("c0") = dirfd;
+    register intptr_t c1 __asm__("c1") = (intptr_t)path;
+    register intptr_t c2 __asm__("c2") = flags;
+    register intptr_t c3 __asm__("c3") = mode;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1), "C"(c2), "C"(c3));
+    return (int)c0;
+}
+
+int open(const char *path, int flags)
+{
+    return openat(AT_FDCWD, path, flags, 0);
+}
+
+int close(int fd)
+{
+    register intptr_t c8 __asm__("c8") = SYS_CLOSE;
+    register intptr_t c0 __asm__("c0") = fd;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0));
+    return (int)c0;
+}
+
+int fstat(int fd, stat_t *st)
+{
+    if (cheri_get_tail(st) < sizeof(stat_t)) {
+        return -EFAULT;
+    }
+    register intptr_t c8 __asm__("c8") = SYS_FSTAT;
+    register intptr_t c0 __asm__("c0") = fd;
+    register intptr_t c1 __asm__("c1") = (intptr_t)st;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1) : "memory");
+    return (int)c0;
+}
+
+/**
+ * Gathered write. Only the iovec array itself is checked here: the
+ * number of entries is clamped to what fits into the capability for
+ * `iov`. Each buffer capability is checked by the kernel.
+ */
+ssize_t writev(int fd, const iovec_t *iov, int iovcnt)
+{
+    size_t max = cheri_get_tail(iov) / sizeof(iovec_t);
+    if (iovcnt < 0 || (size_t)iovcnt > max) {
+        iovcnt = max;
+    }
+    if (iovcnt == 0) {
+        return 0l;
+    }
+    register intptr_t c8 __asm__("c8") = SYS_WRITEV;
+    register intptr_t c0 __asm__("c0") = fd;
+    register intptr_t c1 __asm__("c1") = (intptr_t)iov;
+    register intptr_t c2 __asm__("c2") = iovcnt;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1), "C"(c2));
+    return c0;
+}
+
+/**
+ * Maps `len` bytes of file `fd` at `offset` (or anonymous memory if
+ * `fd` is -1 and MAP_ANONYMOUS is set). The returned capability is
+ * bounded to `len` bytes and is untagged on error.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, int64_t offset)
 {
     register intptr_t c8 __asm__("c8") = SYS_MMAP;
     register intptr_t c0 __asm__("c0") = (intptr_t)addr;
     register intptr_t c1 __asm__("c1") = len;
     register intptr_t c2 __asm__("c2") = prot;
     register intptr_t c3 __asm__("c3") = flags;
-    register intptr_t c4 __asm__("c4") = -1;
-    register intptr_t c5 __asm__("c5") = 0;
+    register intptr_t c4 __asm__("c4") = fd;
+    register intptr_t c5 __asm__("c5") = offset;
     __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "C"(c0), "C"(c1), "C"(c2), "C"(c3), "C"(c4), "C"(c5));
     return (void *)cheri_bounds_set(c0, len);
 }
@@ -63,3 +154,25 @@ int munmap(void *addr, size_t len)
     __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "C"(c0), "C"(c1));
     return (int)c0;
 }
+
+void *mremap(void *addr, size_t old_len, size_t new_len, int flags)
+{
+    register intptr_t c8 __asm__("c8") = SYS_MREMAP;
+    register intptr_t c0 __asm__("c0") = (intptr_t)addr;
+    register intptr_t c1 __asm__("c1") = old_len;
+    register intptr_t c2 __asm__("c2") = new_len;
+    register intptr_t c3 __asm__("c3") = flags;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "C"(c0), "C"(c1), "C"(c2), "C"(c3));
+    return (void *)cheri_bounds_set(c0, new_len);
+}
+
+int futex(int *addr, int op, int val, const timespec_t *timeout)
+{
+    register intptr_t c8 __asm__("c8") = SYS_FUTEX;
+    register intptr_t c0 __asm__("c0") = (intptr_t)addr;
+    register intptr_t c1 __asm__("c1") = op;
+    register intptr_t c2 __asm__("c2") = val;
+    register intptr_t c3 __asm__("c3") = (intptr_t)timeout;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "C"(c0), "C"(c1), "C"(c2), "C"(c3) : "memory");
+    return (int)c0;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "morello.h"
+
+/**
+ * Threads on top of the `clone` system call.
+ *
+ * Each thread gets one private mapping that contains (from the lowest
+ * address) a guard page, the stack and a control block: the thread
+ * structure followed by the TLS block. The thread only receives a
+ * stack capability bounded to the stack area, so stack overflows fault
+ * either on the guard page or on the capability bounds. The thread
+ * structure is stored in `CTPIDR_EL0` and can be retrieved with
+ * `thread_self`.
+ *
+ * When a thread exits, the kernel clears its `tid` field and wakes up
+ * futex waiters on it (CLONE_CHILD_CLEARTID), which is what
+ * `thread_join` waits for before unmapping the thread's memory.
+ */
+
+#define CLONE_VM                0x00000100
+#define CLONE_FS                0x00000200
+#define CLONE_FILES             0x00000400
+#define CLONE_SIGHAND           0x00000800
+#define CLONE_THREAD            0x00010000
+#define CLONE_SYSVSEM           0x00040000
+#define CLONE_SETTLS            0x00080000
+#define CLONE_PARENT_SETTID     0x00100000
+#define CLONE_CHILD_CLEARTID    0x00200000
+
+#define CLONE_THREAD_FLAGS (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD \
+    | CLONE_SYSVSEM | CLONE_SETTLS | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+#define FUTEX_WAIT_PRIVATE      (FUTEX_WAIT | FUTEX_PRIVATE_FLAG)
+#define FUTEX_WAKE_PRIVATE      (FUTEX_WAKE | FUTEX_PRIVATE_FLAG)
+
+#define INT_MAX 0x7fffffff
+
+struct thread {
+    void *tls;              // TLS block of THREAD_TLS_SIZE bytes
+    void *(*fn)(void *);
+    void *arg;
+    void *result;
+    int tid;                // cleared by the kernel when the thread exits
+    void *map;              // owning capability for the mapping (NULL for the main thread)
+    size_t map_size;
+};
+
+static char main_tls[THREAD_TLS_SIZE] __attribute__((aligned(16)));
+static thread_t main_thread = { .tls = main_tls };
+
+static inline void set_thread_pointer(thread_t *t)
+{
+    __asm__ __volatile__ ("msr ctpidr_el0, %0\n" :: "C"(t));
+}
+
+/**
+ * Sets up the main thread. Called from `init`.
+ */
+void init_threads()
+{
+    set_thread_pointer(&main_thread);
+}
+
+thread_t *thread_self()
+{
+    thread_t *t;
+    __asm__ ("mrs %0, ctpidr_el0\n" : "=C"(t));
+    return t;
+}
+
+void *thread_tls()
+{
+    return thread_self()->tls;
+}
+
+static void futex_wait(int *addr, int val)
+{
+    futex(addr, FUTEX_WAIT_PRIVATE, val, NULL);
+}
+
+static void futex_wake(int *addr, int count)
+{
+    futex(addr, FUTEX_WAKE_PRIVATE, count, NULL);
+}
+
+void thread_exit(void *result)
+{
+    thread_t *self = thread_self();
+    self->result = result;
+    register intptr_t c8 __asm__("c8") = SYS_EXIT;
+    register intptr_t c0 __asm__("c0") = 0;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0) : "memory");
+    __builtin_unreachable();
+}
+
+/**
+ * Entry point of a new thread, called on the new stack.
+ */
+__attribute__((used, noreturn))
+static void thread_start(thread_t *self)
+{
+    set_thread_pointer(self);
+    thread_exit(self->fn(self->arg));
+}
+
+/**
+ * Calls `clone` with the given stack and thread structure. The child
+ * does not return from here: it starts executing `thread_start` right
+ * after the system call, before touching the parent's stack.
+ */
+static int clone_thread(void *stack, thread_t *t)
+{
+    register intptr_t c8 __asm__("c8") = SYS_CLONE;
+    register intptr_t c0 __asm__("c0") = CLONE_THREAD_FLAGS;
+    register intptr_t c1 __asm__("c1") = (intptr_t)stack;
+    register intptr_t c2 __asm__("c2") = (intptr_t)&t->tid;
+    register intptr_t c3 __asm__("c3") = (intptr_t)t;
+    register intptr_t c4 __asm__("c4") = (intptr_t)&t->tid;
+    __asm__ __volatile__ (
+        "svc 0\n"
+        "cbnz x0, 1f\n"
+        "mov c0, c3\n"
+        "bl thread_start\n"
+        "1:\n"
+        : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1), "C"(c2), "C"(c3), "C"(c4) : "memory");
+    return (int)c0;
+}
+
+/**
+ * Creates a new thread that will run `fn(arg)`. The stack will be
+ * `stack_size` bytes (rounded up to the page size) or THREAD_STACK_SIZE
+ * if `stack_size` is 0. Returns 0 on success and stores the thread in
+ * `thread`, returns negative value on error.
+ */
+int thread_create(thread_t **thread, void *(*fn)(void *), void *arg, size_t stack_size)
+{
+    size_t pgsz = getpagesize();
+    if (stack_size == 0ul) {
+        stack_size = THREAD_STACK_SIZE;
+    }
+    stack_size = cheri_representable_length((stack_size + pgsz - 1) & ~(pgsz - 1));
+    size_t ctl_size = (sizeof(thread_t) + THREAD_TLS_SIZE + pgsz - 1) & ~(pgsz - 1);
+    size_t map_size = pgsz + stack_size + ctl_size;
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE | PROT_MAX(PROT_READ | PROT_WRITE),
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!cheri_tag_get(map)) {
+        return -1;
+    }
+    if (mprotect(map, pgsz, PROT_NONE) != 0) {
+        munmap(map, map_size);
+        return -1;
+    }
+    void *ctl = map + pgsz + stack_size;
+    thread_t *t = cheri_bounds_set_exact(ctl, sizeof(thread_t));
+    t->tls = cheri_bounds_set_exact(ctl + sizeof(thread_t), THREAD_TLS_SIZE);
+    t->fn = fn;
+    t->arg = arg;
+    t->result = NULL;
+    t->map = map;
+    t->map_size = map_size;
+    void *stack = cheri_bounds_set(map + pgsz, stack_size);
+    stack = cheri_perms_and(stack, ~PERM_EXECUTE);
+    int r = clone_thread(stack + stack_size, t);
+    if (r < 0) {
+        munmap(map, map_size);
+        return r;
+    }
+    *thread = t;
+    return 0;
+}
+
+/**
+ * Waits for the thread to exit, stores its result in `result` (unless
+ * it is NULL) and releases its stack and TLS. Returns 0 on success.
+ */
+int thread_join(thread_t *thread, void **result)
+{
+    if (!cheri_is_deref(thread) || thread->map == NULL) {
+        return -1;
+    }
+    for (int tid; (tid = __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE)) != 0;) {
+        futex_wait(&thread->tid, tid);
+    }
+    if (result) {
+        *result = thread->result;
+    }
+    return munmap(thread->map, thread->map_size);
+}
+
+/**
+ * Mutex with three states: 0 (unlocked), 1 (locked) and 2 (locked
+ * and possibly contended). Unlocking only needs a system call in the
+ * last state.
+ */
+void mutex_lock(mutex_t *m)
+{
+    int s = 0;
+    if (__atomic_compare_exchange_n(&m->state, &s, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (s != 2) {
+        s = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while (s != 0) {
+        futex_wait(&m->state, 2);
+        s = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+bool mutex_trylock(mutex_t *m)
+{
+    int s = 0;
+    return __atomic_compare_exchange_n(&m->state, &s, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_unlock(mutex_t *m)
+{
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) {
+        futex_wake(&m->state, 1);
+    }
+}
+
+/**
+ * Condition variable: a sequence number bumped by every signal.
+ * Waiters sleep until the number changes, so a signal sent between
+ * unlocking the mutex and going to sleep is not lost. Spurious
+ * wakeups are possible, callers must recheck their condition.
+ */
+void cond_wait(cond_t *c, mutex_t *m)
+{
+    int seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    mutex_unlock(m);
+    futex_wait(&c->seq, seq);
+    // other waiters may have been woken too: lock as contended
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex_wait(&m->state, 2);
+    }
+}
+
+void cond_signal(cond_t *c)
+{
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, 1);
+}
+
+void cond_broadcast(cond_t *c)
+{
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, INT_MAX);
+}
+
+/**
+ * Calls `fn` exactly once for a given `once_t`. Concurrent callers
+ * wait until the first call has completed.
+ */
+void once(once_t *o, void (*fn)(void))
+{
+    int s = __atomic_load_n(&o->state, __ATOMIC_ACQUIRE);
+    if (s == 2) {
+        return;
+    }
+    if (s == 0 && __atomic_compare_exchange_n(&o->state, &s, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        fn();
+        __atomic_store_n(&o->state, 2, __ATOMIC_RELEASE);
+        futex_wake(&o->state, INT_MAX);
+        return;
+    }
+    while ((s = __atomic_load_n(&o->state, __ATOMIC_ACQUIRE)) != 2) {
+        futex_wait(&o->state, s);
+    }
+}
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "auxv.h"
+#include "morello.h"
+
+/**
+ * Time functions backed by the vDSO.
+ *
+ * The kernel maps a small shared object (vDSO) into every process and
+ * passes a capability for it in `AT_SYSINFO_EHDR`. Its functions read
+ * the time from the data pages shared with the kernel and the system
+ * counter without entering the kernel. The capability covers the whole
+ * vDSO mapping (including the data pages), so function capabilities
+ * are derived from it without narrowing the bounds.
+ *
+ * If there is no vDSO or a symbol can't be found, the corresponding
+ * system call is used instead.
+ */
+
+#define PT_LOAD         1
+#define PT_DYNAMIC      2
+
+#define DT_NULL         0
+#define DT_HASH         4
+#define DT_STRTAB       5
+#define DT_SYMTAB       6
+#define DT_STRSZ        10
+#define DT_GNU_HASH     0x6ffffef5
+
+#define STT_FUNC        2
+
+typedef struct {
+    unsigned char e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint64_t e_entry;
+    uint64_t e_phoff;
+    uint64_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} elf_ehdr_t;
+
+typedef struct {
+    uint32_t p_type;
+    uint32_t p_flags;
+    uint64_t p_offset;
+    uint64_t p_vaddr;
+    uint64_t p_paddr;
+    uint64_t p_filesz;
+    uint64_t p_memsz;
+    uint64_t p_align;
+} elf_phdr_t;
+
+typedef struct {
+    int64_t d_tag;
+    uint64_t d_val;
+} elf_dyn_t;
+
+typedef struct {
+    uint32_t st_name;
+    unsigned char st_info;
+    unsigned char st_other;
+    uint16_t st_shndx;
+    uint64_t st_value;
+    uint64_t st_size;
+} elf_sym_t;
+
+typedef int (vdso_clock_gettime_t)(int clk, timespec_t *ts);
+typedef int (vdso_gettimeofday_t)(timeval_t *tv, void *tz);
+
+static struct {
+    void *image;            // capability for the vDSO (from AT_SYSINFO_EHDR)
+    size_t size;            // size of the image
+    size_t bias;            // load bias: image offset = vaddr - bias
+    const elf_sym_t *symtab;
+    size_t nsyms;
+    const char *strtab;
+    size_t strsz;
+    size_t clrperm;         // permissions removed from function capabilities
+    vdso_clock_gettime_t *clock_gettime;
+    vdso_gettimeofday_t *gettimeofday;
+} vdso;
+
+/**
+ * Returns capability for `size` bytes at offset `off` in the vDSO image
+ * or NULL if this range is outside the image.
+ */
+static const void *vdso_at(size_t off, size_t size)
+{
+    if (off > vdso.size || size > vdso.size - off) {
+        return NULL;
+    }
+    return cheri_bounds_set(vdso.image + off, size);
+}
+
+static const void *vdso_vaddr(uint64_t vaddr, size_t size)
+{
+    return vaddr < vdso.bias ? NULL : vdso_at(vaddr - vdso.bias, size);
+}
+
+/**
+ * Returns number of symbols described by the GNU hash table: this is
+ * one more than the highest symbol index found in its hash chains.
+ */
+static size_t gnu_hash_nsyms(uint64_t vaddr)
+{
+    const uint32_t *hdr = vdso_vaddr(vaddr, 4 * sizeof(uint32_t));
+    if (hdr == NULL) {
+        return 0ul;
+    }
+    size_t nbuckets = hdr[0], symoffset = hdr[1], nwords = hdr[2];
+    vaddr += 4 * sizeof(uint32_t) + nwords * sizeof(uint64_t);
+    const uint32_t *buckets = vdso_vaddr(vaddr, nbuckets * sizeof(uint32_t));
+    if (buckets == NULL) {
+        return 0ul;
+    }
+    size_t last = 0;
+    for (size_t k = 0; k < nbuckets; k++) {
+        last = buckets[k] > last ? buckets[k] : last;
+    }
+    if (last < symoffset) {
+        return symoffset;
+    }
+    // walk the chain of the last bucket until its end marker
+    uint64_t chains = vaddr + nbuckets * sizeof(uint32_t);
+    for (;; last++) {
+        const uint32_t *h = vdso_vaddr(chains + (last - symoffset) * sizeof(uint32_t), sizeof(uint32_t));
+        if (h == NULL) {
+            return 0ul;
+        }
+        if (*h & 1u) {
+            return last + 1;
+        }
+    }
+}
+
+/**
+ * Parses the vDSO ELF image: finds dynamic symbol and string tables.
+ */
+static bool vdso_parse(void *image)
+{
+    vdso.image = image;
+    vdso.size = cheri_get_tail(image);
+    const elf_ehdr_t *eh = vdso_at(0, sizeof(elf_ehdr_t));
+    if (eh == NULL || eh->e_ident[0] != 0x7f || eh->e_ident[1] != 'E'
+        || eh->e_ident[2] != 'L' || eh->e_ident[3] != 'F' || eh->e_phentsize != sizeof(elf_phdr_t)) {
+        return false;
+    }
+    const elf_phdr_t *ph = vdso_at(eh->e_phoff, eh->e_phnum * sizeof(elf_phdr_t));
+    if (ph == NULL) {
+        return false;
+    }
+    const elf_phdr_t *load = NULL, *dynamic = NULL;
+    for (size_t k = 0; k < eh->e_phnum; k++) {
+        if (ph[k].p_type == PT_LOAD && load == NULL) {
+            load = &ph[k];
+        } else if (ph[k].p_type == PT_DYNAMIC) {
+            dynamic = &ph[k];
+        }
+    }
+    if (load == NULL || dynamic == NULL) {
+        return false;
+    }
+    vdso.bias = load->p_vaddr - load->p_offset;
+    const elf_dyn_t *dyn = vdso_at(dynamic->p_offset, dynamic->p_filesz);
+    if (dyn == NULL) {
+        return false;
+    }
+    uint64_t hash = 0, gnu_hash = 0, symtab = 0, strtab = 0, strsz = 0;
+    for (size_t k = 0; k < dynamic->p_filesz / sizeof(elf_dyn_t) && dyn[k].d_tag != DT_NULL; k++) {
+        switch (dyn[k].d_tag) {
+            case DT_HASH: hash = dyn[k].d_val; break;
+            case DT_GNU_HASH: gnu_hash = dyn[k].d_val; break;
+            case DT_SYMTAB: symtab = dyn[k].d_val; break;
+            case DT_STRTAB: strtab = dyn[k].d_val; break;
+            case DT_STRSZ: strsz = dyn[k].d_val; break;
+        }
+    }
+    if (hash) {
+        const uint32_t *h = vdso_vaddr(hash, 2 * sizeof(uint32_t));
+        vdso.nsyms = h ? h[1] : 0ul; // nchain
+    } else if (gnu_hash) {
+        vdso.nsyms = gnu_hash_nsyms(gnu_hash);
+    }
+    vdso.symtab = vdso_vaddr(symtab, vdso.nsyms * sizeof(elf_sym_t));
+    vdso.strtab = vdso_vaddr(strtab, strsz);
+    vdso.strsz = strsz;
+    return vdso.symtab != NULL && vdso.strtab != NULL && vdso.nsyms > 0;
+}
+
+/**
+ * Returns sentry for a vDSO function or NULL if it is not found.
+ */
+void *vdso_sym(const char *name)
+{
+    if (vdso.symtab == NULL) {
+        return NULL;
+    }
+    for (size_t k = 0; k < vdso.nsyms; k++) {
+        const elf_sym_t *s = &vdso.symtab[k];
+        if ((s->st_info & 0xf) != STT_FUNC || s->st_shndx == 0 || s->st_name >= vdso.strsz) {
+            continue;
+        }
+        if (strcmp(vdso.strtab + s->st_name, name) == 0) {
+            const void *fn = vdso_vaddr(s->st_value & ~1ul, 1);
+            if (fn == NULL) {
+                return NULL;
+            }
+            // keep bounds of the whole mapping, C64 functions have bit 0 set
+            void *cap = cheri_address_set(vdso.image, cheri_address_get(fn) | (s->st_value & 1ul));
+            cap = cheri_perms_and(cap, ~vdso.clrperm);
+            return cheri_sentry_create(cap);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Finds the vDSO time functions. Called from `init`. If `restricted`
+ * is set, the functions will run in Restricted mode.
+ */
+void init_vdso(bool restricted)
+{
+    void *image = getauxptr(AT_SYSINFO_EHDR);
+    if (!cheri_is_deref(image) || !cheri_check_perms(image, PERM_EXECUTE | PERM_LOAD)) {
+        return;
+    }
+    vdso.clrperm = restricted ? (PERM_EXECUTIVE | PERM_SYS_REG) : 0ul;
+    if (vdso_parse(image)) {
+        vdso.clock_gettime = (vdso_clock_gettime_t *)vdso_sym("__kernel_clock_gettime");
+        vdso.gettimeofday = (vdso_gettimeofday_t *)vdso_sym("__kernel_gettimeofday");
+    }
+}
+
+static int sys_clock_gettime(int clk, timespec_t *ts)
+{
+    register intptr_t c8 __asm__("c8") = SYS_CLOCK_GETTIME;
+    register intptr_t c0 __asm__("c0") = clk;
+    register intptr_t c1 __asm__("c1") = (intptr_t)ts;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1) : "memory");
+    return (int)c0;
+}
+
+static int sys_gettimeofday(timeval_t *tv, void *tz)
+{
+    register intptr_t c8 __asm__("c8") = SYS_GETTIMEOFDAY;
+    register intptr_t c0 __asm__("c0") = (intptr_t)tv;
+    register intptr_t c1 __asm__("c1") = (intptr_t)tz;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1) : "memory");
+    return (int)c0;
+}
+
+/**
+ * Returns time of the clock `clk` (one of CLOCK_*) in `ts`.
+ * Returns 0 on success and negative error code otherwise.
+ */
+int clock_gettime(int clk, timespec_t *ts)
+{
+    if (cheri_get_tail(ts) < sizeof(timespec_t)) {
+        return -1;
+    }
+    if (vdso.clock_gettime) {
+        return vdso.clock_gettime(clk, ts);
+    }
+    return sys_clock_gettime(clk, ts);
+}
+
+/**
+ * Returns wall clock time in `tv`. Time zone `tz` is obsolete
+ * and should be NULL.
+ */
+int gettimeofday(timeval_t *tv, void *tz)
+{
+    if (cheri_get_tail(tv) < sizeof(timeval_t)) {
+        return -1;
+    }
+    if (vdso.gettimeofday) {
+        return vdso.gettimeofday(tv, tz);
+    }
+    return sys_gettimeofday(tv, tz);
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "uring.h"
+#include "morello.h"
+
+/**
+ * Asynchronous I/O with io_uring.
+ *
+ * The submission (SQ) and completion (CQ) rings and the array of
+ * submission queue entries are shared with the kernel and mapped with
+ * `mmap`. Entries are prepared locally (`uring_get_sqe` and
+ * `uring_prep_*`) and published in one go by `uring_submit`, which
+ * needs a single system call for the whole batch. Completions are
+ * consumed directly from the CQ ring without system calls unless the
+ * caller has to wait.
+ *
+ * Capabilities for the ring fields are bounded to the respective
+ * field, and `uring_get_sqe` returns a capability bounded to one
+ * entry, so preparing an entry can't corrupt its neighbours or the
+ * ring indices.
+ */
+
+static_assert(sizeof(void *) != 16 || sizeof(io_uring_sqe_t) == 128, "PCuABI SQE layout");
+static_assert(sizeof(void *) != 16 || sizeof(io_uring_cqe_t) == 32, "PCuABI CQE layout");
+
+static int io_uring_setup(unsigned entries, io_uring_params_t *p)
+{
+    register intptr_t c8 __asm__("c8") = SYS_IO_URING_SETUP;
+    register intptr_t c0 __asm__("c0") = entries;
+    register intptr_t c1 __asm__("c1") = (intptr_t)p;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1) : "memory");
+    return (int)c0;
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    register intptr_t c8 __asm__("c8") = SYS_IO_URING_ENTER;
+    register intptr_t c0 __asm__("c0") = fd;
+    register intptr_t c1 __asm__("c1") = to_submit;
+    register intptr_t c2 __asm__("c2") = min_complete;
+    register intptr_t c3 __asm__("c3") = flags;
+    register intptr_t c4 __asm__("c4") = 0;
+    register intptr_t c5 __asm__("c5") = 0;
+    __asm__ __volatile__ ("svc 0\n" : "=C"(c0) : "C"(c8), "0"(c0), "C"(c1), "C"(c2), "C"(c3), "C"(c4), "C"(c5) : "memory");
+    return (int)c0;
+}
+
+static void *ring_field(void *map, uint32_t offset, size_t size)
+{
+    return cheri_bounds_set_exact(map + offset, size);
+}
+
+/**
+ * Sets up an io_uring instance with at least `entries` submission
+ * queue entries. Returns 0 on success or negative error code (e.g.
+ * when io_uring is not supported by the kernel).
+ */
+int uring_init(uring_t *ring, unsigned entries)
+{
+    if (cheri_get_tail(ring) < sizeof(uring_t)) {
+        return -EFAULT;
+    }
+    memset(ring, 0, sizeof(uring_t));
+    ring->fd = -1;
+    io_uring_params_t p;
+    memset(&p, 0, sizeof(p));
+    int fd = io_uring_setup(entries, &p);
+    if (fd < 0) {
+        return fd;
+    }
+    ring->fd = fd;
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_POPULATE;
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe_t);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && cq_size > sq_size) {
+        sq_size = cq_size;
+    }
+    void *sq = mmap(NULL, sq_size, prot, flags, fd, IORING_OFF_SQ_RING);
+    if (!cheri_tag_get(sq)) {
+        uring_exit(ring);
+        return (int)cheri_address_get(sq);
+    }
+    ring->sq_map = sq;
+    ring->sq_map_size = sq_size;
+    void *cq = sq;
+    if (!single) {
+        cq = mmap(NULL, cq_size, prot, flags, fd, IORING_OFF_CQ_RING);
+        if (!cheri_tag_get(cq)) {
+            uring_exit(ring);
+            return (int)cheri_address_get(cq);
+        }
+        ring->cq_map = cq;
+        ring->cq_map_size = cq_size;
+    }
+    size_t sqe_size = p.sq_entries * sizeof(io_uring_sqe_t);
+    void *sqes = mmap(NULL, sqe_size, prot, flags, fd, IORING_OFF_SQES);
+    if (!cheri_tag_get(sqes)) {
+        uring_exit(ring);
+        return (int)cheri_address_get(sqes);
+    }
+    ring->sqe_map = sqes;
+    ring->sqe_map_size = sqe_size;
+    ring->sqes = cheri_bounds_set_exact(sqes, sqe_size);
+    ring->sq_head = ring_field(sq, p.sq_off.head, sizeof(uint32_t));
+    ring->sq_tail = ring_field(sq, p.sq_off.tail, sizeof(uint32_t));
+    ring->sq_array = ring_field(sq, p.sq_off.array, p.sq_entries * sizeof(uint32_t));
+    ring->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->cq_head = ring_field(cq, p.cq_off.head, sizeof(uint32_t));
+    ring->cq_tail = ring_field(cq, p.cq_off.tail, sizeof(uint32_t));
+    ring->cqes = ring_field(cq, p.cq_off.cqes, p.cq_entries * sizeof(io_uring_cqe_t));
+    ring->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+    ring->sqe_head = ring->sqe_tail = *ring->sq_tail;
+    return 0;
+}
+
+/**
+ * Unmaps the rings and closes the io_uring file descriptor.
+ */
+void uring_exit(uring_t *ring)
+{
+    if (ring->sqe_map) {
+        munmap(ring->sqe_map, ring->sqe_map_size);
+    }
+    if (ring->cq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(uring_t));
+    ring->fd = -1;
+}
+
+/**
+ * Returns the next free submission queue entry (bounded to this entry
+ * and cleared) or NULL if the queue is full.
+ */
+io_uring_sqe_t *uring_get_sqe(uring_t *ring)
+{
+    uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    io_uring_sqe_t *sqe = cheri_bounds_set_exact(&ring->sqes[ring->sqe_tail & ring->sq_mask], sizeof(io_uring_sqe_t));
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(io_uring_sqe_t));
+    return sqe;
+}
+
+static void prep_rw(io_uring_sqe_t *sqe, int op, int fd, const void *buf, size_t len, uint64_t offset, void *user_data)
+{
+    size_t tail = cheri_get_tail(buf);
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (void *)buf;
+    sqe->len = len < tail ? len : tail;
+    sqe->user_data = user_data;
+}
+
+/**
+ * Prepares a read of up to `len` bytes (clamped to the bounds of `buf`)
+ * at `offset`, or at the current file position if `offset` is -1.
+ */
+void uring_prep_read(io_uring_sqe_t *sqe, int fd, void *buf, size_t len, uint64_t offset, void *user_data)
+{
+    prep_rw(sqe, IORING_OP_READ, fd, buf, len, offset, user_data);
+}
+
+/**
+ * Prepares a write of up to `len` bytes (clamped to the bounds of `buf`)
+ * at `offset`, or at the current file position if `offset` is -1.
+ * The buffer must stay valid until the completion is received.
+ */
+void uring_prep_write(io_uring_sqe_t *sqe, int fd, const void *buf, size_t len, uint64_t offset, void *user_data)
+{
+    prep_rw(sqe, IORING_OP_WRITE, fd, buf, len, offset, user_data);
+}
+
+/**
+ * Publishes all prepared entries and submits them with one system
+ * call, optionally waiting for `wait_nr` completions. Returns the
+ * number of submitted entries or negative error code.
+ */
+int uring_submit(uring_t *ring, unsigned wait_nr)
+{
+    uint32_t tail = *ring->sq_tail;
+    uint32_t n = ring->sqe_tail - ring->sqe_head;
+    for (; ring->sqe_head != ring->sqe_tail; ring->sqe_head++, tail++) {
+        ring->sq_array[tail & ring->sq_mask] = ring->sqe_head & ring->sq_mask;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    if (n == 0 && wait_nr == 0) {
+        return 0;
+    }
+    return io_uring_enter(ring->fd, n, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0u);
+}
+
+/**
+ * Returns the next completion or NULL if there is none yet. The entry
+ * must be released with `uring_cqe_seen`.
+ */
+io_uring_cqe_t *uring_peek_cqe(uring_t *ring)
+{
+    uint32_t head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return cheri_bounds_set_exact(&ring->cqes[head & ring->cq_mask], sizeof(io_uring_cqe_t));
+}
+
+/**
+ * Waits for the next completion. Returns 0 on success.
+ */
+int uring_wait_cqe(uring_t *ring, io_uring_cqe_t **cqe)
+{
+    for (;;) {
+        io_uring_cqe_t *c = uring_peek_cqe(ring);
+        if (c != NULL) {
+            *cqe = c;
+            return 0;
+        }
+        int r = io_uring_enter(ring->fd, 0u, 1u, IORING_ENTER_GETEVENTS);
+        if (r < 0) {
+            return r;
+        }
+    }
+}
+
+void uring_cqe_seen(uring_t *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
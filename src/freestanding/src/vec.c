@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2023 Arm Limited. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "libc.h"
+#include "morello.h"
+
+/**
+ * Growable vectors.
+ *
+ * Elements are kept in a private anonymous mapping owned by the
+ * vector. To grow, the mapping is resized with `mremap`: the kernel
+ * extends it in place or moves its pages elsewhere, so no data is
+ * copied and capabilities stored in the vector keep their tags however
+ * dense the array is. The mapping size doubles while it is below
+ * VEC_GROW_LIMIT and then grows in steps of VEC_GROW_LIMIT, so large
+ * vectors don't reserve much more than they use.
+ *
+ * `v->data` is derived again after every change of size and is bounded
+ * to the elements in use, without the permission to change the mapping.
+ * Capabilities obtained before growing the vector may point to the old
+ * location and must not be used afterwards.
+ */
+
+static size_t vec_grow_size(size_t size, size_t need)
+{
+    size_t pgsz = getpagesize();
+    if (size == 0ul) {
+        size = pgsz;
+    }
+    while (size < need) {
+        size = size < VEC_GROW_LIMIT ? 2 * size : size + VEC_GROW_LIMIT;
+    }
+    return (cheri_representable_length(size) + pgsz - 1) & ~(pgsz - 1);
+}
+
+static void vec_bound(vec_t *v)
+{
+    size_t len = v->count * v->elem_size;
+    // the mapping is aligned for its own (representable) size
+    void *data = cheri_representable_length(len) == len
+        ? cheri_bounds_set_exact(v->map, len)
+        : cheri_bounds_set(v->map, len);
+    v->data = cheri_perms_and(data, ~(size_t)PERM_VMEM);
+}
+
+/**
+ * Initialises an empty vector of elements of `elem_size` bytes with
+ * room for at least `capacity` elements. Returns 0 on success or
+ * negative error code.
+ */
+int vec_init(vec_t *v, size_t elem_size, size_t capacity)
+{
+    if (cheri_get_tail(v) < sizeof(vec_t) || elem_size == 0ul) {
+        return -EFAULT;
+    }
+    v->data = v->map = NULL;
+    v->elem_size = elem_size;
+    v->count = v->capacity = v->map_size = 0ul;
+    return vec_reserve(v, capacity ? capacity : 1ul);
+}
+
+/**
+ * Makes sure that at least `capacity` elements fit without growing
+ * the mapping. Returns 0 on success or negative error code; the
+ * vector is unchanged on failure.
+ */
+int vec_reserve(vec_t *v, size_t capacity)
+{
+    size_t need;
+    if (capacity <= v->capacity) {
+        return 0;
+    }
+    if (__builtin_mul_overflow(capacity, v->elem_size, &need) || need > (1ul << 47)) {
+        return -ENOMEM;
+    }
+    size_t size = vec_grow_size(v->map_size, need);
+    void *map;
+    if (v->map == NULL) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        map = mremap(v->map, v->map_size, size, MREMAP_MAYMOVE);
+    }
+    if (!cheri_tag_get(map)) {
+        return (int)cheri_address_get(map);
+    }
+    v->map = map;
+    v->map_size = size;
+    v->capacity = size / v->elem_size;
+    vec_bound(v);
+    return 0;
+}
+
+/**
+ * Changes the number of elements to `count`. New elements are zeroed.
+ * Returns 0 on success or negative error code.
+ */
+int vec_resize(vec_t *v, size_t count)
+{
+    int r = vec_reserve(v, count);
+    if (r < 0) {
+        return r;
+    }
+    if (count > v->count) {
+        memset(v->map + v->count * v->elem_size, 0, (count - v->count) * v->elem_size);
+    }
+    v->count = count;
+    vec_bound(v);
+    return 0;
+}
+
+/**
+ * Appends an element (copied from `elem` or zeroed if it is NULL) and
+ * returns a capability bounded to it, or NULL if the vector can't grow.
+ */
+void *vec_push(vec_t *v, const void *elem)
+{
+    if (v->count == v->capacity && vec_reserve(v, v->count + 1) < 0) {
+        return NULL;
+    }
+    v->count++;
+    vec_bound(v);
+    void *slot = cheri_bounds_set(v->data + (v->count - 1) * v->elem_size, v->elem_size);
+    if (elem != NULL) {
+        memcpy(slot, elem, v->elem_size);
+    } else {
+        memset(slot, 0, v->elem_size);
+    }
+    return slot;
+}
+
+/**
+ * Unmaps the vector's memory.
+ */
+void vec_free(vec_t *v)
+{
+    if (v->map != NULL) {
+        munmap(v->map, v->map_size);
+    }
+    v->data = v->map = NULL;
+    v->count = v->capacity = v->map_size = 0ul;
+}
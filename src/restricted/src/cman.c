@@ -10,14 +10,6 @@
 
 #include "rcmpt.h"
 
-#define MAP_PRIVATE     0x02
-#define MAP_ANONYMOUS   0x20
-
-#define PROT_READ   1
-#define PROT_WRITE  2
-#define PROT_EXEC   4
-#define PROT_MAX(p) ((p) << 16)
-
 // Note: this is obviously sensitive data, but it can
 // be protected using BRS-sealed pair of capabilities
 // (see the `src/compartments/privdata.c` example).
@@ -34,7 +26,7 @@ static void *get_cmpt_stack(size_t size)
 {
     int prot = PROT_READ | PROT_WRITE;
     int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-    void *stack = mmap(NULL, size, prot, flags);
+    void *stack = mmap(NULL, size, prot, flags, -1, 0);
     stack = cheri_align_down(stack + size, sizeof(void *));
     return cheri_perms_and(stack, PERM_GLOBAL | READ_CAP_PERMS | WRITE_CAP_PERMS);
 }
@@ -112,7 +104,7 @@ switch_t *create_compartment(void *target, unsigned stack_pages)
     // Generate thunk code:
     int prot = PROT_READ | PROT_WRITE | PROT_MAX(PROT_READ | PROT_WRITE | PROT_EXEC);
     int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-    void *code = mmap(NULL, ctx.pgsz, prot, flags); // 1 page is enough for thunk code and thunk data
+    void *code = mmap(NULL, ctx.pgsz, prot, flags, -1, 0); // 1 page is enough for thunk code and thunk data
     memcpy(code, ctx._thunk, ctx.thunk_size);
 
     // Setup thunk data used by the switch:
@@ -10,7 +10,6 @@ typedef _Bool bool;
 
 #include "morello.h"
 
-int sprintf(char *dst, const char *fmt, ...);
 char *strcpy(char *dst, const char *src);
 
 #define NULL ((void *)0)
@@ -42,8 +41,48 @@ static size_t permbits[] = {
     0ul
 };
 
+static const char hexdigits[16] = "0123456789abcdef";
+
 static char buf[128];
 
+/**
+ * Prints `ndigits` least significant hex digits of `val` (with leading
+ * zeros). Returns pointer to the next character after the digits.
+ */
+static char *put_hex(char *dst, size_t val, size_t ndigits)
+{
+    for (size_t k = ndigits; k > 0; k--) {
+        dst[k - 1] = hexdigits[val & 0xful];
+        val >>= 4;
+    }
+    return dst + ndigits;
+}
+
+/**
+ * Prints `val` in decimal. Returns pointer to the next character
+ * after the digits.
+ */
+static char *put_dec(char *dst, size_t val)
+{
+    char tmp[20], *t = tmp + sizeof(tmp);
+    do {
+        *(--t) = '0' + val % 10ul;
+        val /= 10ul;
+    } while (val);
+    while (t < tmp + sizeof(tmp)) {
+        *(dst++) = *(t++);
+    }
+    return dst;
+}
+
+static char *put_str(char *dst, const char *src)
+{
+    while (*src) {
+        *(dst++) = *(src++);
+    }
+    return dst;
+}
+
 const char *cap_perms_to_str(char *dst, const void * __capability cap)
 {
     if (dst == NULL) {
@@ -81,30 +120,56 @@ const char *cap_seal_to_str(char *dst, const void * __capability cap)
             strcpy(dst, "lb");
             break;
         default:
-            sprintf(dst, "%04x", otype);
+            *put_hex(dst, otype, 4) = '\0';
     }
     return res;
 }
 
 /**
  * Prints detailed information about capability to string.
+ * Limit and length of a NULL capability are printed as 0.
  */
 const char *cap_to_str(char *dst, const void * __capability cap)
+{
+    return cap_to_str_tag(dst, cap, cheri_tag_get(cap));
+}
+
+const char *cap_to_str_tag(char *dst, const void * __capability cap, bool tag)
 {
     if (dst == NULL) {
         dst = buf;
     }
-    size_t tag = cheri_tag_get(cap);
     size_t addr = cheri_address_get(cap);
     size_t base = cheri_base_get(cap);
-    size_t len = cheri_length_get(cap);
+    size_t len = cheri_length_get_zero(cap);
     size_t lim = base + len;
     ssize_t offset = (ssize_t)cheri_offset_get(cap);
 
-    char perm[19];
-    char seal[5];
-    sprintf(dst, "%016lx %c [%016lx:%016lx) %s %-4s %ld of %lu",
-        addr, tag ? '1' : '0', base, lim, cap_perms_to_str(perm, cap),
-        cap_seal_to_str(seal, cap), offset, len);
+    // "%016lx %c [%016lx:%016lx) %s %-4s %ld of %lu"
+    char *p = put_hex(dst, addr, 16);
+    p = put_str(p, tag ? " 1 [" : " 0 [");
+    p = put_hex(p, base, 16);
+    *(p++) = ':';
+    p = put_hex(p, lim, 16);
+    p = put_str(p, ") ");
+    cap_perms_to_str(p, cap);
+    p += sizeof(permnames) - 1;
+    *(p++) = ' ';
+    char *seal = p;
+    cap_seal_to_str(seal, cap);
+    while (*p) {
+        p++;
+    }
+    while (p < seal + 4) {
+        *(p++) = ' ';
+    }
+    *(p++) = ' ';
+    if (offset < 0) {
+        *(p++) = '-';
+    }
+    p = put_dec(p, offset < 0 ? 0ul - (size_t)offset : (size_t)offset);
+    p = put_str(p, " of ");
+    p = put_dec(p, len);
+    *p = '\0';
     return dst;
 }
@@ -51,6 +51,11 @@ bool cheri_is_local(const void * __capability cap);
  * Using it may be unsafe.
  */
 const char *cap_to_str(char *dst, const void * __capability cap);
+/**
+ * Same as cap_to_str but prints the given tag instead of the tag of
+ * cap (e.g. for an untagged copy of a capability that was tagged).
+ */
+const char *cap_to_str_tag(char *dst, const void * __capability cap, bool tag);
 const char *cap_perms_to_str(char *dst, const void * __capability cap);
 const char *cap_seal_to_str(char *dst, const void * __capability cap);
 